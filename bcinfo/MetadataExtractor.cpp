@@ -79,6 +79,10 @@ static const llvm::StringRef ExportForEachNameMetadataName =
 // (should be synced with slang_rs_metadata.h)
 static const llvm::StringRef ExportForEachMetadataName = "#rs_export_foreach";
 
+// Name of metadata node where exported reduction kernel information resides
+// (should be synced with slang_rs_metadata.h)
+static const llvm::StringRef ExportReduceMetadataName = "#rs_export_reduce";
+
 // Name of metadata node where RS object slot info resides (should be
 // synced with slang_rs_metadata.h)
 static const llvm::StringRef ObjectSlotMetadataName = "#rs_object_slots";
@@ -94,7 +98,8 @@ MetadataExtractor::MetadataExtractor(const char *bitcode, size_t bitcodeSize)
       mExportVarCount(0), mExportFuncCount(0), mExportForEachSignatureCount(0),
       mExportVarNameList(nullptr), mExportFuncNameList(nullptr),
       mExportForEachNameList(nullptr), mExportForEachSignatureList(nullptr),
-      mExportForEachInputCountList(nullptr), mPragmaCount(0),
+      mExportForEachInputCountList(nullptr), mExportReduceCount(0),
+      mExportReduceList(nullptr), mPragmaCount(0),
       mPragmaKeyList(nullptr), mPragmaValueList(nullptr), mObjectSlotCount(0),
       mObjectSlotList(nullptr), mRSFloatPrecision(RS_FP_Full),
       mIsThreadable(true), mBuildChecksum(nullptr) {
@@ -110,7 +115,8 @@ MetadataExtractor::MetadataExtractor(const llvm::Module *module)
       mExportFuncCount(0), mExportForEachSignatureCount(0),
       mExportVarNameList(nullptr), mExportFuncNameList(nullptr),
       mExportForEachNameList(nullptr), mExportForEachSignatureList(nullptr),
-      mExportForEachInputCountList(nullptr), mPragmaCount(0),
+      mExportForEachInputCountList(nullptr), mExportReduceCount(0),
+      mExportReduceList(nullptr), mPragmaCount(0),
       mPragmaKeyList(nullptr), mPragmaValueList(nullptr), mObjectSlotCount(0),
       mObjectSlotList(nullptr), mRSFloatPrecision(RS_FP_Full),
       mIsThreadable(true), mBuildChecksum(nullptr) {
@@ -150,6 +156,9 @@ MetadataExtractor::~MetadataExtractor() {
   delete [] mExportForEachSignatureList;
   mExportForEachSignatureList = nullptr;
 
+  delete [] mExportReduceList;
+  mExportReduceList = nullptr;
+
   for (size_t i = 0; i < mPragmaCount; i++) {
     if (mPragmaKeyList) {
       delete [] mPragmaKeyList[i];
@@ -447,6 +456,110 @@ bool MetadataExtractor::populateForEachMetadata(
 }
 
 
+MetadataExtractor::Reduce::~Reduce() {
+  delete [] mReduceName;
+  delete [] mInitializerName;
+  delete [] mAccumulatorName;
+  delete [] mCombinerName;
+  delete [] mOutConverterName;
+}
+
+
+// Returns the name held by the single operand of the optional function node
+// \p Node, or nullptr if the node is missing or empty (function not given).
+static const char *createFunctionNameFromNode(const llvm::Metadata *Node) {
+  auto *FuncNode = llvm::dyn_cast_or_null<const llvm::MDNode>(Node);
+  if (FuncNode == nullptr || FuncNode->getNumOperands() == 0) {
+    return nullptr;
+  }
+  return createStringFromValue(FuncNode->getOperand(0));
+}
+
+
+// Each operand of #rs_export_reduce describes one reduction kernel:
+//
+//   !{!"name", !"accumulatorDataSize",
+//     !{!"initializer"},
+//     !{!"accumulator", !"signature"},
+//     !{!"combiner"},
+//     !{!"outconverter"}}
+//
+// The initializer, combiner and outconverter nodes are empty (!{}) when the
+// script does not provide that function.
+bool MetadataExtractor::populateReduceMetadata(
+    const llvm::NamedMDNode *ReduceMetadata) {
+  mExportReduceCount = 0;
+  mExportReduceList = nullptr;
+
+  if (!ReduceMetadata || !ReduceMetadata->getNumOperands()) {
+    return true;
+  }
+
+  size_t Count = ReduceMetadata->getNumOperands();
+  Reduce *TmpReduceList = new Reduce[Count];
+
+  for (size_t i = 0; i < Count; i++) {
+    Reduce &R = TmpReduceList[i];
+    llvm::MDNode *ReduceNode = ReduceMetadata->getOperand(i);
+    if (ReduceNode == nullptr || ReduceNode->getNumOperands() != 6) {
+      ALOGE("Corrupt reduce information");
+      delete [] TmpReduceList;
+      return false;
+    }
+
+    R.mReduceName = createStringFromValue(ReduceNode->getOperand(0));
+
+    if (!extractUIntFromMetadataString(&R.mAccumulatorDataSize,
+                                       ReduceNode->getOperand(1))) {
+      ALOGE("Non-integer accumulator data size value in reduce '%s'",
+            R.mReduceName);
+      delete [] TmpReduceList;
+      return false;
+    }
+
+    auto *AccumulatorNode =
+        llvm::dyn_cast_or_null<const llvm::MDNode>(ReduceNode->getOperand(3));
+    if (AccumulatorNode == nullptr || AccumulatorNode->getNumOperands() != 2) {
+      ALOGE("Corrupt accumulator information in reduce '%s'", R.mReduceName);
+      delete [] TmpReduceList;
+      return false;
+    }
+    R.mAccumulatorName = createStringFromValue(AccumulatorNode->getOperand(0));
+    if (!extractUIntFromMetadataString(&R.mSignature,
+                                       AccumulatorNode->getOperand(1))) {
+      ALOGE("Non-integer accumulator signature value in reduce '%s'",
+            R.mReduceName);
+      delete [] TmpReduceList;
+      return false;
+    }
+
+    R.mInitializerName = createFunctionNameFromNode(ReduceNode->getOperand(2));
+    R.mCombinerName = createFunctionNameFromNode(ReduceNode->getOperand(4));
+    R.mOutConverterName =
+        createFunctionNameFromNode(ReduceNode->getOperand(5));
+
+    // The accumulator takes the accumulator data pointer, then its inputs,
+    // then the special arguments.
+    const llvm::Function *Func =
+        mModule->getFunction(llvm::StringRef(R.mAccumulatorName));
+    if (Func != nullptr) {
+      uint32_t OtherCount = 1;
+      OtherCount += hasForEachSignatureX(R.mSignature);
+      OtherCount += hasForEachSignatureY(R.mSignature);
+      OtherCount += hasForEachSignatureZ(R.mSignature);
+      OtherCount += hasForEachSignatureCtxt(R.mSignature);
+      R.mInputCount = Func->arg_size() >= OtherCount ?
+          Func->arg_size() - OtherCount : 0;
+    }
+  }
+
+  mExportReduceCount = Count;
+  mExportReduceList = TmpReduceList;
+
+  return true;
+}
+
+
 void MetadataExtractor::readThreadableFlag(
     const llvm::NamedMDNode *ThreadableMetadata) {
 
@@ -521,6 +634,8 @@ bool MetadataExtractor::extract() {
       mModule->getNamedMetadata(ExportForEachNameMetadataName);
   const llvm::NamedMDNode *ExportForEachMetadata =
       mModule->getNamedMetadata(ExportForEachMetadataName);
+  const llvm::NamedMDNode *ExportReduceMetadata =
+      mModule->getNamedMetadata(ExportReduceMetadataName);
   const llvm::NamedMDNode *PragmaMetadata =
       mModule->getNamedMetadata(PragmaMetadataName);
   const llvm::NamedMDNode *ObjectSlotMetadata =
@@ -547,6 +662,11 @@ bool MetadataExtractor::extract() {
     return false;
   }
 
+  if (!populateReduceMetadata(ExportReduceMetadata)) {
+    ALOGE("Could not populate reduce metadata");
+    return false;
+  }
+
   populatePragmaMetadata(PragmaMetadata);
 
   if (!populateObjectSlotMetadata(ObjectSlotMetadata)) {
@@ -59,10 +59,12 @@ extern int optind;
 bool translateFlag = false;
 bool infoFlag = false;
 bool verbose = true;
+// Target API of input bitcode that has no wrapper (as set with -a).
+unsigned int apiFlag = 0;
 
 static int parseOption(int argc, char** argv) {
   int c;
-  while ((c = getopt(argc, argv, "itv")) != -1) {
+  while ((c = getopt(argc, argv, "a:itv")) != -1) {
     opterr = 0;
 
     switch(c) {
@@ -70,6 +72,10 @@ static int parseOption(int argc, char** argv) {
         // ignore any error
         break;
 
+      case 'a':
+        apiFlag = strtoul(optarg, nullptr, 10);
+        break;
+
       case 't':
         translateFlag = true;
         break;
@@ -197,6 +203,22 @@ static void dumpMetadata(bcinfo::MetadataExtractor *ME) {
   }
   printf("\n");
 
+  printf("exportReduceCount: %zu\n", ME->getExportReduceCount());
+  const bcinfo::MetadataExtractor::Reduce *reduceList =
+      ME->getExportReduceList();
+  for (size_t i = 0; i < ME->getExportReduceCount(); i++) {
+    const bcinfo::MetadataExtractor::Reduce &reduce = reduceList[i];
+    auto nullable = [](const char *name) { return name ? name : "<none>"; };
+    printf("exportReduceList[%zu]: %s - 0x%08x - %u - %u\n", i,
+           reduce.mReduceName, reduce.mSignature, reduce.mInputCount,
+           reduce.mAccumulatorDataSize);
+    printf("  initializer: %s\n", nullable(reduce.mInitializerName));
+    printf("  accumulator: %s\n", reduce.mAccumulatorName);
+    printf("  combiner: %s\n", nullable(reduce.mCombinerName));
+    printf("  outconverter: %s\n", nullable(reduce.mOutConverterName));
+  }
+  printf("\n");
+
   printf("pragmaCount: %zu\n", ME->getPragmaCount());
   const char **keyList = ME->getPragmaKeyList();
   const char **valueList = ME->getPragmaValueList();
@@ -278,6 +300,8 @@ int main(int argc, char** argv) {
     if (verbose) {
       printf("Found bitcodeWrapper\n");
     }
+  } else if (apiFlag != 0) {
+    version = apiFlag;
   } else if (translateFlag) {
     version = 12;
   }
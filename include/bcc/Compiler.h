@@ -17,6 +17,12 @@
 #ifndef BCC_COMPILER_H
 #define BCC_COMPILER_H
 
+#include "bcc/Support/CompilerConfig.h"
+
+#include <list>
+#include <string>
+#include <utility>
+
 namespace llvm {
 
 class raw_ostream;
@@ -34,7 +40,8 @@ using legacy::PassManager;
 
 namespace bcc {
 
-class CompilerConfig;
+class CompilePassReport;
+class CompilePhaseTimes;
 class OutputFile;
 class Script;
 
@@ -50,6 +57,10 @@ class Script;
 // 4. Once a compiler instance is created, you can use the compile() service
 //    to compile the file over and over again. Each call uses TargetMachine
 //    instance to construct the compilation passes.
+// 5. The compiler keeps the TargetMachines of the last few configurations it
+//    has seen. Switching back to one of those configurations (e.g., between
+//    full- and relaxed-precision scripts) reuses its TargetMachine instead of
+//    creating a new one.
 class Compiler {
 public:
   enum ErrorCode {
@@ -78,15 +89,62 @@ private:
   // Optimization is enabled by default.
   bool mEnableOpt;
 
+  // Run the unroll and vectorization passes after LTO
+  // (CompilerConfig::getVectorize()).
+  bool mEnableVectorize;
+
+  // Use addRSOptimizationPasses() instead of the generic LTO pipeline
+  // (CompilerConfig::getRSPipeline()).
+  bool mEnableRSPipeline;
+
+  // CompilerConfig::getMultiVersion().
+  bool mEnableMultiVersion;
+
+  // CompilerConfig::getExpandTiles().
+  bool mEnableExpandTiles;
+
+  // Attach the fast-math flags rs_fp_relaxed allows to the floating point
+  // operations (!CompilerConfig::getFullPrecision()).
+  bool mEnableRelaxedFPMath;
+
+  // CompilerConfig::getInlineThreshold() and getRegAlloc().
+  int mInlineThreshold;
+  CompilerConfig::RegAllocKind mRegAlloc;
+
+  // The maximum number of TargetMachines kept in mTargetPool.
+  static const unsigned kTargetPoolSize = 4;
+
+  // Recently used TargetMachines keyed by CompilerConfig::serializeTarget(),
+  // most recently used first. mTarget, if set, is the first entry. The pool owns
+  // the TargetMachines.
+  typedef std::list<std::pair<std::string, llvm::TargetMachine *> >
+      TargetPool;
+  TargetPool mTargetPool;
+
+  // How often config() found (hits) or had to create (misses) the
+  // TargetMachine for the requested configuration.
+  unsigned mTargetPoolHits;
+  unsigned mTargetPoolMisses;
+
+  // If not null, compile() and screenGlobalFunctions() add the time they
+  // spend in each phase here.
+  CompilePhaseTimes *mPhaseTimes;
+
+  // If not null, runPasses() records the cost of every pass here.
+  CompilePassReport *mPassReport;
+
   enum ErrorCode runPasses(Script &pScript, llvm::raw_pwrite_stream &pResult);
 
   bool addCustomPasses(Script &pScript, llvm::legacy::PassManager &pPM);
   bool addInternalizeSymbolsPass(Script &pScript, llvm::legacy::PassManager &pPM);
   bool addExpandForEachPass(Script &pScript, llvm::legacy::PassManager &pPM);
   bool addGlobalInfoPass(Script &pScript, llvm::legacy::PassManager &pPM);
+  bool addProfilePass(Script &pScript, llvm::legacy::PassManager &pPM);
   bool addInvariantPass(llvm::legacy::PassManager &pPM);
+  bool addFastMathPass(llvm::legacy::PassManager &pPM);
   bool addInvokeHelperPass(llvm::legacy::PassManager &pPM);
   bool addPostLTOCustomPasses(llvm::legacy::PassManager &pPM);
+  void addRSOptimizationPasses(llvm::legacy::PassManager &pPM);
 
 public:
   Compiler();
@@ -111,6 +169,21 @@ public:
   void enableOpt(bool pEnable = true)
   { mEnableOpt = pEnable; }
 
+  unsigned getTargetPoolHits() const
+  { return mTargetPoolHits; }
+
+  unsigned getTargetPoolMisses() const
+  { return mTargetPoolMisses; }
+
+  void setPhaseTimes(CompilePhaseTimes *pPhaseTimes)
+  { mPhaseTimes = pPhaseTimes; }
+
+  // Instrument every pass of the following compilations and record their
+  // time and effect on the IR size in pPassReport. This slows compilation
+  // down; pass nullptr to stop.
+  void setPassReport(CompilePassReport *pPassReport)
+  { mPassReport = pPassReport; }
+
   ~Compiler();
 
   // Compare undefined external functions in pScript against a 'whitelist' of
@@ -18,27 +18,53 @@
 #define BCC_RS_COMPILER_DRIVER_H
 
 #include "bcc/Compiler.h"
+#include "bcc/Renderscript/RSProfile.h"
 #include "bcc/Renderscript/RSScript.h"
+#include "bcc/Support/CompilePassReport.h"
+#include "bcc/Support/CompilePhaseTimes.h"
 
 #include "bcinfo/MetadataExtractor.h"
 
 #include <list>
+#include <memory>
 #include <string>
 #include <vector>
 
+namespace llvm {
+template <typename T> class SmallVectorImpl;
+} // end namespace llvm
+
 namespace bcc {
 
 class BCCContext;
 class CompilerConfig;
+class ObjectCache;
 class RSCompilerDriver;
 class Source;
 
+// A script to be compiled by RSCompilerDriver::buildBatch(). The strings and
+// the bitcode must stay valid until buildBatch() returns.
+struct RSBuildJob {
+  const char *mResName;
+  const char *mBitcode;
+  size_t mBitcodeSize;
+  const char *mBuildChecksum;
+};
+
 // Type signature for dynamically loaded initialization of an RSCompilerDriver.
 typedef void (*RSCompilerDriverInit_t) (bcc::RSCompilerDriver *);
 // Name of the function that we attempt to dynamically load/execute.
 #define RS_COMPILER_DRIVER_INIT_FN rsCompilerDriverInit
 
 class RSCompilerDriver {
+public:
+  // When to run the unroll and vectorization passes after LTO.
+  enum VectorizeMode {
+    kVectorizeRelaxed,  // Only for scripts with #pragma rs_fp_relaxed.
+    kVectorizeAlways,
+    kVectorizeNever
+  };
+
 private:
   CompilerConfig *mConfig;
   Compiler mCompiler;
@@ -64,17 +90,134 @@ private:
   // when potentially embedding information about globals.
   bool mEmbedGlobalInfoSkipConstant;
 
+  // Specifies whether only the used parts of the runtime library are linked
+  // into scripts (see RSScript::setSelectiveRuntimeImport()).
+  bool mSelectiveRuntimeImport;
+
+  // Specifies whether outputs are published with a write-then-rename instead
+  // of being rewritten in place under a FileMutex.
+  bool mAtomicPublish;
+
+  // Time spent in each phase of the last build.
+  CompilePhaseTimes mPhaseTimes;
+
+  // Specifies whether mPassReport is filled in.
+  bool mInstrumentPasses;
+
+  // Cost of each pass of the last build, if mInstrumentPasses is set.
+  CompilePassReport mPassReport;
+
+  // Which scripts are vectorized.
+  VectorizeMode mVectorizeMode;
+
+  // Specifies whether the RS-tuned optimization pipeline replaces LLVM's
+  // generic LTO pipeline.
+  bool mUseRSPipeline;
+
+  // Inlining threshold scripts are optimized with, or -1 for the default of
+  // the pipeline.
+  int mInlineThreshold;
+
+  // Specifies whether the expanded kernels are cloned for newer CPU variants
+  // of the architecture.
+  bool mMultiVersionKernels;
+
+  // Specifies whether kernels also get tiled expanded functions.
+  bool mExpandTiles;
+
+  // Specifies whether scripts are compiled with profile counters.
+  bool mProfileInstrument;
+
+  // If not empty, the profile scripts are optimized with, and its contents
+  // as of the current build.
+  std::string mProfilePath;
+  RSProfile mProfile;
+
+  // If not 0, the estimated compile cost (see setCompileBudget()) that
+  // setupScript() lowers the optimization of a script to fit.
+  unsigned mCompileBudget;
+
+  // If not null, build() looks up and stores compiled objects here.
+  ObjectCache *mObjectCache;
+
+  // Specifies whether buildTiered() runs optimized tiers in a child process
+  // instead of a thread.
+  bool mOptimizedTierProcess;
+
+  // The background compilations started by buildTiered() that have not been
+  // found finished by a later buildTiered() call yet.
+  struct OptimizedTier;
+  std::list<std::shared_ptr<OptimizedTier> > mOptimizedTiers;
+
   // Setup the compiler config for the given script. Return true if mConfig has
   // been changed and false if it remains unchanged.
   bool setupConfig(const RSScript &pScript);
 
+  // Apply the driver's options and the information from the bitcode wrapper
+  // of pBitcode to pScript.
+  void setupScript(RSScript &pScript, const char *pBitcode,
+                   size_t pBitcodeSize,
+                   RSLinkRuntimeCallback pLinkRuntimeCallback);
+
+  // Lower the optimization of pScript, as set up from its bitcode wrapper,
+  // until its estimated compile cost fits mCompileBudget.
+  void fitCompileBudget(RSScript &pScript, size_t pBitcodeSize) const;
+
+  // Embeds the checksum into pScript, screens it, links it with the runtime
+  // and configures mCompiler for it. This is everything compileScript() does
+  // short of generating code.
+  Compiler::ErrorCode prepareScript(RSScript &pScript, const char *pScriptName,
+                                    const char *pRuntimePath,
+                                    const char *pBuildChecksum);
+
   // Compiles the provided bitcode, placing the binary at pOutputPath.
   // - If pDumpIR is true, a ".ll" file will also be created.
+  // - If pCacheKey is not null, the binary is also stored in mObjectCache
+  //   under it, before the lock on pOutputPath is released.
   Compiler::ErrorCode compileScript(RSScript& pScript, const char* pScriptName,
                                     const char* pOutputPath,
                                     const char* pRuntimePath,
                                     const char* pBuildChecksum,
-                                    bool pDumpIR);
+                                    bool pDumpIR,
+                                    const char *pCacheKey = nullptr);
+
+  // build(), but compile at -O0 if pQuickTier is set, and embed the
+  // RenderScript info in the object like buildForCompatLib() if pEmbedInfo is.
+  bool buildObject(BCCContext &pContext, const char *pCacheDir,
+                   const char *pResName, const char *pBitcode,
+                   size_t pBitcodeSize, const char *pBuildChecksum,
+                   const char *pRuntimePath,
+                   RSLinkRuntimeCallback pLinkRuntimeCallback, bool pDumpIR,
+                   bool pQuickTier, bool pEmbedInfo);
+
+  // The part of compileScript() that writes pOutputPath when mAtomicPublish
+  // is set.
+  Compiler::ErrorCode compileScriptAtomically(RSScript &pScript,
+                                              const char *pOutputPath,
+                                              bool pDumpIR,
+                                              const char *pCacheKey);
+
+  // Like compileScript(), but places the binary in pObject and, if pIR is not
+  // null, the IR in pIR. No file is touched.
+  Compiler::ErrorCode compileScriptToMemory(RSScript &pScript,
+                                            const char *pScriptName,
+                                            const char *pRuntimePath,
+                                            const char *pBuildChecksum,
+                                            llvm::SmallVectorImpl<char> &pObject,
+                                            std::string *pIR);
+
+  // Make this driver compile like pOther: copy its configuration and
+  // options and configure mCompiler accordingly. Return false on error.
+  bool inheritSettings(const RSCompilerDriver &pOther);
+
+  // Compute the object cache key for compiling pBitcode against the runtime
+  // at pRuntimePath with the current mConfig.
+  // Return false if some input could not be read, in which case the object
+  // cache must not be used.
+  bool computeObjectCacheKey(const char *pBitcode, size_t pBitcodeSize,
+                             const char *pBuildChecksum,
+                             const char *pRuntimePath,
+                             std::string &pKey) const;
 
 public:
   RSCompilerDriver(bool pUseCompilerRT = true);
@@ -133,6 +276,159 @@ public:
     return mEmbedGlobalInfoSkipConstant;
   }
 
+  // Set to true to link only the runtime functions a script (transitively)
+  // uses instead of the whole runtime library.
+  void setSelectiveRuntimeImport(bool v) {
+    mSelectiveRuntimeImport = v;
+  }
+
+  bool getSelectiveRuntimeImport() const {
+    return mSelectiveRuntimeImport;
+  }
+
+  // Set to true to write each output to a unique temporary file next to it
+  // and rename() it into place once complete. Readers then always see a
+  // consistent file without taking the output's lock file.
+  void setAtomicPublish(bool v) {
+    mAtomicPublish = v;
+  }
+
+  bool getAtomicPublish() const {
+    return mAtomicPublish;
+  }
+
+  // Set to true to have buildTiered() fork a child process for each optimized
+  // tier instead of starting a thread. The child carries on after the caller
+  // exits, which suits command-line tools; it should not be used from a
+  // multithreaded process.
+  void setOptimizedTierProcess(bool v) {
+    mOptimizedTierProcess = v;
+  }
+
+  bool getOptimizedTierProcess() const {
+    return mOptimizedTierProcess;
+  }
+
+  // Select which scripts have their (expanded kernel) loops unrolled and
+  // SLP-vectorized. The default is kVectorizeRelaxed.
+  void setVectorizeMode(VectorizeMode pMode) {
+    mVectorizeMode = pMode;
+  }
+
+  VectorizeMode getVectorizeMode() const {
+    return mVectorizeMode;
+  }
+
+  // Set to true to optimize with a pipeline tuned for RS scripts (inlining
+  // the runtime into the expanded kernels, then loop optimizations) instead
+  // of LLVM's generic LTO pipeline. It is off by default: it has not been
+  // shown to match the generic pipeline in code quality and compile time
+  // yet (see tests/pipeline/compare_pipelines.sh).
+  void setUseRSPipeline(bool v) {
+    mUseRSPipeline = v;
+  }
+
+  bool getUseRSPipeline() const {
+    return mUseRSPipeline;
+  }
+
+  // Set the inlining threshold of the optimization pipeline, overriding the
+  // default of the optimization level (or 1000 with setUseRSPipeline()).
+  // Passing -1 restores the default. A compile budget may still lower it.
+  void setInlineThreshold(int pInlineThreshold) {
+    mInlineThreshold = pInlineThreshold;
+  }
+
+  int getInlineThreshold() const {
+    return mInlineThreshold;
+  }
+
+  // Set to true to also compile the expanded kernels for newer CPU variants
+  // of the target architecture than the configured one, for example AVX2 on
+  // x86. The runtime selects the variant through the resolver described in
+  // RSMultiVersion.h. This only pays off for objects compiled for a baseline
+  // CPU, such as those of the compatibility library.
+  void setMultiVersionKernels(bool v) {
+    mMultiVersionKernels = v;
+  }
+
+  bool getMultiVersionKernels() const {
+    return mMultiVersionKernels;
+  }
+
+  // Set to true to also expand every kernel into a function over a tile of
+  // rows and slices, which the runtime can call instead of calling the
+  // .expand function once per row (see RSExpandTile.h).
+  void setExpandTiles(bool v) {
+    mExpandTiles = v;
+  }
+
+  bool getExpandTiles() const {
+    return mExpandTiles;
+  }
+
+  // Set to true to add counters to the kernels, the invokable functions and
+  // the script functions they call, for the runtime to write out as a
+  // profile (see RSProfile::collect()).
+  void setProfileInstrument(bool v) {
+    mProfileInstrument = v;
+  }
+
+  bool getProfileInstrument() const {
+    return mProfileInstrument;
+  }
+
+  // Optimize scripts with the profile in pProfilePath (written from a run of
+  // an instrumented build), which is read anew by every build. Only the
+  // parts of the profile for the script's build checksum are used. Passing
+  // nullptr stops using a profile.
+  void setProfilePath(const char *pProfilePath) {
+    mProfilePath = (pProfilePath != nullptr) ? pProfilePath : "";
+  }
+
+  // Compile scripts at the highest optimization (up to the level from the
+  // bitcode wrapper) whose estimated compile cost fits pBudget. The cost is
+  // a relative measure that grows with the size of the script and with the
+  // optimization level, not a time: it selects a cheaper tier for bigger
+  // scripts, and a higher budget allows more optimization. A budget of 0
+  // turns this off.
+  void setCompileBudget(unsigned pBudget) {
+    mCompileBudget = pBudget;
+  }
+
+  unsigned getCompileBudget() const {
+    return mCompileBudget;
+  }
+
+  // Returns the time spent in each phase of the last build*() call.
+  const CompilePhaseTimes &getPhaseTimes() const {
+    return mPhaseTimes;
+  }
+
+  // Set to true to record the time and IR size change of every pass run by
+  // the compiler. This slows compilation down and is meant for finding out
+  // which passes dominate the compile time of a script.
+  void setInstrumentPasses(bool v) {
+    mInstrumentPasses = v;
+    mCompiler.setPassReport(v ? &mPassReport : nullptr);
+  }
+
+  bool getInstrumentPasses() const {
+    return mInstrumentPasses;
+  }
+
+  // Returns the per-pass report of the last build*() call. Empty unless
+  // setInstrumentPasses(true) was called.
+  const CompilePassReport &getPassReport() const {
+    return mPassReport;
+  }
+
+  // Cache compiled objects in pCacheDir, keyed by a digest of the bitcode,
+  // the runtime library, the compiler configuration and the driver options.
+  // A build() whose key is already present copies the cached object instead
+  // of compiling. Passing nullptr disables the cache.
+  void setObjectCacheDir(const char *pCacheDir);
+
   // FIXME: This method accompany with loadScript and compileScript should
   //        all be const-methods. They're not now because the getAddress() in
   //        SymbolResolverInterface is not a const-method.
@@ -143,6 +439,56 @@ public:
              RSLinkRuntimeCallback pLinkRuntimeCallback = nullptr,
              bool pDumpIR = false);
 
+  // Like build() above, but instead of writing {pCacheDir}/{pResName}.o,
+  // place the ELF object in pObject and, if pIR is not null, the IR fed to
+  // code generation in pIR. This involves no output or lock files, so the
+  // object can be loaded in-process or sent elsewhere directly. The object
+  // cache is not consulted.
+  bool build(BCCContext& pContext, const char* pResName,
+             const char* pBitcode, size_t pBitcodeSize,
+             const char *pBuildChecksum, const char* pRuntimePath,
+             llvm::SmallVectorImpl<char> &pObject, std::string *pIR = nullptr);
+
+  // Like build(), but first compile at -O0, which is several times faster,
+  // and return as soon as that object is in place. A background thread (or
+  // process, see setOptimizedTierProcess()) then compiles the script at the
+  // optimization level it asks for and rename()s the result over the quick
+  // object, so readers see one or the other but never a partial file. A
+  // script asking for -O0 is simply built. If pEmbedRSInfo is true, both
+  // objects embed the RenderScript info like buildForCompatLib() does.
+  //
+  // The optimized tier works on copies of the inputs and of the driver's
+  // options. The destructor waits for tiers running on threads; tiers
+  // running in child processes carry on after the driver and the caller are
+  // gone. Every call forgets the tiers that have finished by then, after
+  // which isOptimizedTierReady() no longer reports on them.
+  bool buildTiered(BCCContext& pContext, const char* pCacheDir,
+                   const char* pResName, const char* pBitcode,
+                   size_t pBitcodeSize, const char *pBuildChecksum,
+                   const char* pRuntimePath, bool pEmbedRSInfo = false);
+
+  // Returns true once {pCacheDir}/{pResName}.o built by buildTiered() holds
+  // the optimized object.
+  bool isOptimizedTierReady(const char *pCacheDir, const char *pResName);
+
+  // Block until every optimized tier has finished. Returns true if all of
+  // them were compiled successfully. Only callers that need the optimized
+  // objects right away should call this.
+  bool waitForOptimizedTiers();
+
+  // Compile every job in pJobs like build() would, i.e., into
+  // {pCacheDir}/{mResName}.o, on up to pNumThreads worker threads (0 means
+  // one per CPU). Each worker compiles with its own BCCContext, Compiler and
+  // TargetMachine, configured like this driver. Resource names must be
+  // unique within the batch. Any link-runtime callback is shared by all
+  // workers and so must be thread-safe.
+  //
+  // On return pResults[i] tells whether pJobs[i] was compiled successfully.
+  // Returns true if all of them were.
+  bool buildBatch(const char *pCacheDir, const std::vector<RSBuildJob> &pJobs,
+                  const char *pRuntimePath, std::vector<bool> &pResults,
+                  unsigned pNumThreads = 0);
+
   bool buildScriptGroup(
       BCCContext& Context, const char* pOutputFilepath, const char* pRuntimePath,
       const char* pRuntimeRelaxedPath, bool dumpIR, const char* buildChecksum,
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_EXPAND_REDUCE_H
+#define BCC_RS_EXPAND_REDUCE_H
+
+namespace bcc {
+
+// For each reduction kernel of a script (see
+// bcinfo::MetadataExtractor::Reduce), the compiler emits
+//
+//   void <accumulator>.expand(const RsExpandKernelDriverInfo *p,
+//                             uint32_t x1, uint32_t x2, uint8_t *accum)
+//
+// which folds the cells [x1, x2) of the current row into the accumulator data
+// at accum by calling the accumulator function once per cell. The input
+// pointers in p must point at the cell x1. Each thread of a launch should
+// have its own accumulator data, set up by the initializer (or zeroed if
+// there is none).
+//
+// The partial results of the threads are then merged pairwise with the
+// combiner. If the script does not give one, the compiler generates
+//
+//   void <accumulator>.combiner(AccumType *accum, const AccumType *other)
+//
+// whenever the accumulator alone can do the job: it must take exactly one
+// input, of the accumulator type, and no special arguments. Otherwise no
+// combiner exists and the runtime has to run the reduction on one thread.
+//
+// The reductions and the names of these functions are listed in the
+// exportReduceCount section of .rs.info.
+extern const char kRsReduceCombinerSuffix[];
+
+} // end namespace bcc
+
+#endif // BCC_RS_EXPAND_REDUCE_H
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_EXPAND_TILE_H
+#define BCC_RS_EXPAND_TILE_H
+
+#include <cstdint>
+
+namespace bcc {
+
+// Scripts compiled with tiled kernels (see RSCompilerDriver::setExpandTiles())
+// contain, next to the <kernel>.expand function of each pass-by-value kernel
+// (those whose signature has MD_SIG_Kernel), a
+//
+//   void <kernel>.expand.tile(const RsExpandKernelDriverInfo *p,
+//                             const RsExpandTile *tile)
+//
+// which runs the kernel over the cells [x1, x2) x [y1, y2) x [z1, z2). The
+// input and output pointers in p must point at the cell (x1, y1, z1); the
+// cells of the other rows and slices are found through the strides of tile.
+// The Y and Z coordinates passed to the kernel come from the tile, not from
+// p->current. This saves a call and the reloads of p per row. Legacy
+// (root-style) kernels have no tiled function; the runtime has to keep
+// calling their <kernel>.expand.
+//
+// Such scripts also define the symbol below as a const uint32_t holding
+// RS_EXPAND_TILE_VERSION, the version of the RsExpandTile layout they use.
+// The runtime should only call the tiled functions if it knows that version.
+#define RS_EXPAND_TILE_VERSION 1
+
+extern const char kRsExpandTileVersion[];
+
+struct RsExpandTile {
+  uint32_t x1, x2;
+  uint32_t y1, y2;
+  uint32_t z1, z2;
+  uint32_t outRowStride;      // In bytes.
+  uint32_t outSliceStride;    // In bytes.
+  uint32_t inRowStride[8];    // In bytes, per input.
+  uint32_t inSliceStride[8];  // In bytes, per input.
+};
+
+} // end namespace bcc
+
+#endif // BCC_RS_EXPAND_TILE_H
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_MULTI_VERSION_H
+#define BCC_RS_MULTI_VERSION_H
+
+namespace bcc {
+
+// A script compiled with multiversioned kernels (see
+// RSCompilerDriver::setMultiVersionKernels()) contains one clone of every
+// .expand function, including the .expand.tile ones (see RSExpandTile.h)
+// and those of the reduction accumulators, per CPU variant of its
+// architecture. The .expand symbols themselves become thunks that jump to
+// the selected clones, which are the baseline ones until the runtime calls
+//
+//   void .rs.expand_resolve(uint32_t cpu_features)
+//
+// with the RSCPUFeature bits of the CPU it runs on. This must happen once,
+// before any kernel of the script is launched. Scripts without kernels, and
+// all scripts for architectures without variants (for example arm64, whose
+// baseline already has NEON), get no clones and no resolver. Neither do
+// 32-bit ARM scripts that require full precision, since NEON is not IEEE 754
+// compliant; for relaxed ones the ARM variant only adds the half-precision
+// conversions and D16-D31 to a baseline that already has NEON.
+extern const char kRsExpandResolve[];
+
+enum RSCPUFeature {
+  kRsCPUNeonFP16 = 1 << 0,  // ARM: NEON and half-precision conversions.
+  kRsCPUSSE42    = 1 << 1,  // x86: SSE4.2 and POPCNT.
+  kRsCPUAVX2     = 1 << 2   // x86: AVX2 and FMA.
+};
+
+} // end namespace bcc
+
+#endif // BCC_RS_MULTI_VERSION_H
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_RS_PROFILE_H
+#define BCC_RS_PROFILE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace bcc {
+
+// Symbols through which a script compiled with profile instrumentation (see
+// RSCompilerDriver::setProfileInstrument()) exposes its counters. The
+// runtime hook that writes the profile reads them like the .rs.global_*
+// symbols, most simply through RSProfile::collect():
+//
+//   .rs.prof_checksum  const char *     build checksum of the script
+//   .rs.prof_entries   uint32_t         number of instrumented functions
+//   .rs.prof_names     const char *[]   name of each function
+//   .rs.prof_counters  uint64_t *[]     counters of each function
+//   .rs.prof_sizes     uint32_t[]       number of counters of each function
+//
+// Counter 0 of a function counts its invocations. Counters 2*i+1 and 2*i+2
+// count how often the i-th conditional branch (in block order) went to its
+// first and its second successor, respectively. For a loop latch this gives
+// the trip count.
+extern const char kRsProfChecksum[];
+extern const char kRsProfEntries[];
+extern const char kRsProfNames[];
+extern const char kRsProfCounters[];
+extern const char kRsProfSizes[];
+
+// Returns the address of the symbol pName of a loaded script, or nullptr if
+// it has none.
+typedef void *(*RSProfileSymbolLookup)(void *pContext, const char *pName);
+
+// The counters of one build of a script, keyed by function name. On disk it
+// is a text file:
+//
+//   rs-profile 1
+//   checksum <build checksum>
+//   function <name> <number of counters>
+//   <counter> <counter> ...
+//   function ...
+class RSProfile {
+public:
+  typedef std::map<std::string, std::vector<uint64_t> > CounterMap;
+
+private:
+  std::string mBuildChecksum;
+  CounterMap mCounters;
+
+public:
+  const std::string &getBuildChecksum() const
+  { return mBuildChecksum; }
+  void setBuildChecksum(const std::string &pBuildChecksum)
+  { mBuildChecksum = pBuildChecksum; }
+
+  const CounterMap &getCounters() const
+  { return mCounters; }
+
+  // Returns the counters of pFunction, or nullptr if there are none.
+  const std::vector<uint64_t> *getCounters(const std::string &pFunction) const;
+
+  // Add pCounters to those of pFunction. Return false if pFunction already
+  // has a different number of counters.
+  bool addCounters(const std::string &pFunction,
+                   const std::vector<uint64_t> &pCounters);
+
+  // Add the counters of a loaded instrumented script, whose symbols
+  // pLookup(pContext, ...) finds. Return false if the script has no counters
+  // or they are of a different build than those already added.
+  bool collect(RSProfileSymbolLookup pLookup, void *pContext);
+
+  void clear() {
+    mBuildChecksum.clear();
+    mCounters.clear();
+  }
+
+  // Replace the contents with the profile in pPath. Return false on error.
+  bool read(const std::string &pPath);
+
+  // Write the profile to pPath. Return false on error.
+  bool write(const std::string &pPath) const;
+};
+
+} // end namespace bcc
+
+#endif  // BCC_RS_PROFILE_H
@@ -18,14 +18,19 @@
 #define BCC_RS_SCRIPT_H
 
 #include "bcc/Script.h"
+#include "bcc/Support/CompilerConfig.h"
 #include "bcc/Support/Sha1Util.h"
 
+#include <set>
+#include <string>
+
 namespace llvm {
   class Module;
 }
 
 namespace bcc {
 
+class RSProfile;
 class RSScript;
 class Source;
 
@@ -49,6 +54,11 @@ private:
 
   OptimizationLevel mOptimizationLevel;
 
+  // Inlining threshold, or -1 for the default of the optimization level.
+  int mInlineThreshold;
+
+  CompilerConfig::RegAllocKind mRegAlloc;
+
   RSLinkRuntimeCallback mLinkRuntimeCallback;
 
   bool mEmbedInfo;
@@ -61,6 +71,22 @@ private:
   // when potentially embedding information about globals.
   bool mEmbedGlobalInfoSkipConstant;
 
+  // Specifies whether LinkRuntime() should import only the runtime functions
+  // the script (transitively) uses instead of the whole runtime library.
+  bool mSelectiveRuntimeImport;
+
+  // Specifies whether the kernels, the invokable functions and the script
+  // functions they call get profile counters (see RSProfile.h).
+  bool mProfileInstrument;
+
+  // If not null, the profile to optimize the script with.
+  const RSProfile *mProfile;
+
+  // The functions the script itself defines, recorded by LinkRuntime() for
+  // profiled builds so that the profile passes can tell them apart from the
+  // runtime functions linked in with them.
+  std::set<std::string> mScriptFunctions;
+
 private:
   // This will be invoked when the containing source has been reset.
   virtual bool doReset();
@@ -88,6 +114,22 @@ public:
     return mOptimizationLevel;
   }
 
+  void setInlineThreshold(int pInlineThreshold) {
+    mInlineThreshold = pInlineThreshold;
+  }
+
+  int getInlineThreshold() const {
+    return mInlineThreshold;
+  }
+
+  void setRegAlloc(CompilerConfig::RegAllocKind pRegAlloc) {
+    mRegAlloc = pRegAlloc;
+  }
+
+  CompilerConfig::RegAllocKind getRegAlloc() const {
+    return mRegAlloc;
+  }
+
   void setLinkRuntimeCallback(RSLinkRuntimeCallback fn){
     mLinkRuntimeCallback = fn;
   }
@@ -121,6 +163,40 @@ public:
   bool getEmbedGlobalInfoSkipConstant() const {
     return mEmbedGlobalInfoSkipConstant;
   }
+
+  // Set to true if only the used parts of the runtime library should be
+  // linked into the script.
+  void setSelectiveRuntimeImport(bool pEnable) {
+    mSelectiveRuntimeImport = pEnable;
+  }
+
+  // Returns true if only the used parts of the runtime library should be
+  // linked into the script.
+  bool getSelectiveRuntimeImport() const {
+    return mSelectiveRuntimeImport;
+  }
+
+  // Set to true to compile the script with profile counters.
+  void setProfileInstrument(bool pEnable) {
+    mProfileInstrument = pEnable;
+  }
+
+  bool getProfileInstrument() const {
+    return mProfileInstrument;
+  }
+
+  // Optimize the script using pProfile, which must outlive the compilation.
+  void setProfile(const RSProfile *pProfile) {
+    mProfile = pProfile;
+  }
+
+  const RSProfile *getProfile() const {
+    return mProfile;
+  }
+
+  const std::set<std::string> &getScriptFunctions() const {
+    return mScriptFunctions;
+  }
 };
 
 } // end namespace bcc
@@ -38,6 +38,10 @@ class BCCContext;
 /// @return True, if kernels are successfully fused. False, otherwise. It's up to
 /// the caller on how to deal with unsuccessful fusion. A script group can
 /// execute with either fused kernels or individual kernels.
+///
+/// The fused kernel is appended to #rs_export_foreach of mergedModule. If
+/// mergedModule belongs to a Source, the caller must invalidate its metadata
+/// (Source::invalidateMetadata()).
 bool fuseKernels(BCCContext& Context,
                  const std::vector<Source *>& sources,
                  const std::vector<int>& slots,
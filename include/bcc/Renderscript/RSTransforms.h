@@ -17,15 +17,31 @@
 #ifndef BCC_RS_TRANSFORMS_H
 #define BCC_RS_TRANSFORMS_H
 
+#include <set>
+#include <string>
+
 namespace llvm {
   class ModulePass;
   class FunctionPass;
 }
 
+namespace bcinfo {
+  class MetadataExtractor;
+}
+
 namespace bcc {
 
+class RSProfile;
+
+// If pMetadata is given, it must be the metadata of the module the pass is
+// run on; otherwise the pass extracts it itself. If pWidenKernelLoops is
+// true, the loops of small kernels handle several cells per iteration. If
+// pExpandTiles is true, kernels also get tiled variants (see RSExpandTile.h).
 llvm::ModulePass *
-createRSForEachExpandPass(bool pEnableStepOpt);
+createRSForEachExpandPass(bool pEnableStepOpt,
+                          const bcinfo::MetadataExtractor *pMetadata = nullptr,
+                          bool pWidenKernelLoops = false,
+                          bool pExpandTiles = false);
 
 llvm::FunctionPass *
 createRSInvariantPass();
@@ -33,6 +49,9 @@ createRSInvariantPass();
 llvm::FunctionPass *
 createRSInvokeHelperPass();
 
+llvm::FunctionPass *
+createRSFastMathPass();
+
 llvm::ModulePass * createRSEmbedInfoPass();
 
 llvm::ModulePass * createRSGlobalInfoPass(bool pSkipConstants);
@@ -43,6 +62,24 @@ llvm::ModulePass * createRSIsThreadablePass();
 
 llvm::ModulePass * createRSX86_64CallConvPass();
 
+// pScriptFunctions are the functions defined by the script rather than by the
+// runtime (see RSScript::getScriptFunctions()); of those, the ones the kernels
+// and invokable functions call are profiled along with them.
+llvm::ModulePass *
+createRSProfileInstrumentPass(const std::set<std::string> &pScriptFunctions);
+
+llvm::ModulePass *
+createRSProfileAnnotatePass(const RSProfile &pProfile,
+                            const std::set<std::string> &pScriptFunctions);
+
+// pBaseFeatures must be the feature string of the target machine.
+// pFullPrecision must be set for scripts that do not allow relaxed floating
+// point, so that they get no variants that break IEEE 754 semantics.
+llvm::ModulePass *
+createRSMultiVersionPass(const std::string &pTriple,
+                         const std::string &pBaseFeatures,
+                         bool pFullPrecision);
+
 } // end namespace bcc
 
 #endif // BCC_RS_TRANSFORMS_H
@@ -18,11 +18,16 @@
 #define BCC_SOURCE_H
 
 #include <string>
+#include <vector>
 
 namespace llvm {
   class Module;
 }
 
+namespace bcinfo {
+  class MetadataExtractor;
+}
+
 namespace bcc {
 
 class BCCContext;
@@ -36,6 +41,9 @@ private:
   // If true, destructor won't destroy the mModule.
   bool mNoDelete;
 
+  // The RS metadata of mModule, extracted on demand. See getMetadata().
+  mutable bcinfo::MetadataExtractor *mMetadata;
+
 private:
   Source(const char* name, BCCContext &pContext, llvm::Module &pModule,
          bool pNoDelete = false);
@@ -49,6 +57,17 @@ public:
   static Source *CreateFromFile(BCCContext &pContext,
                                 const std::string &pPath);
 
+  // Create a Source object holding a copy of the runtime library at pPath.
+  // The library is parsed only once per context (until the file changes), so
+  // this is much cheaper than CreateFromFile() when linking many scripts.
+  //
+  // If pImports is not null, only the named globals and whatever they
+  // reference (transitively) are copied; everything else in the library is
+  // left out. Names the library does not define are ignored.
+  static Source *CreateFromRuntimeFile(
+      BCCContext &pContext, const std::string &pPath,
+      const std::vector<std::string> *pImports = nullptr);
+
   // Create a Source object from an existing module. If pNoDelete
   // is true, destructor won't call delete on the given module.
   static Source *CreateFromModule(BCCContext &pContext,
@@ -82,6 +101,17 @@ public:
 
   void addBuildChecksumMetadata(const char *) const;
 
+  // Returns the RS metadata (exported symbols, pragmas, etc.) of the module,
+  // or nullptr if it cannot be extracted. The metadata is only extracted once
+  // and the result stays valid until invalidateMetadata() is called.
+  //
+  // merge(), setModule() and addBuildChecksumMetadata() invalidate it
+  // themselves; anything else that changes the RS metadata of the module,
+  // e.g., appending kernels to #rs_export_foreach, must call
+  // invalidateMetadata().
+  const bcinfo::MetadataExtractor *getMetadata() const;
+  void invalidateMetadata() const;
+
   ~Source();
 };
 
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_ATOMIC_OUTPUT_FILE_H
+#define BCC_SUPPORT_ATOMIC_OUTPUT_FILE_H
+
+#include <string>
+#include <system_error>
+
+#include <llvm/ADT/SmallString.h>
+
+namespace llvm {
+  class raw_fd_ostream;
+}
+
+namespace bcc {
+
+// An output file that is published atomically. The contents are written to a
+// unique temporary file in the destination's directory, which commit() then
+// rename()s over the destination. Readers therefore see either the previous
+// file or the complete new one, without having to take a FileMutex. If
+// commit() is not called (or fails), the temporary file is removed.
+class AtomicOutputFile {
+private:
+  std::string mPath;
+  llvm::SmallString<128> mTempPath;
+  llvm::raw_fd_ostream *mStream;
+  std::error_code mError;
+
+  void discard();
+
+public:
+  AtomicOutputFile(const std::string &pPath);
+  ~AtomicOutputFile();
+
+  inline bool hasError() const
+  { return (bool) mError; }
+
+  inline std::string getErrorMessage() const
+  { return mError.message(); }
+
+  // The stream to write the contents to. Only valid if !hasError() and
+  // before commit().
+  inline llvm::raw_fd_ostream &getStream()
+  { return *mStream; }
+
+  // Flush the contents and move them into place. Return false on error.
+  bool commit();
+};
+
+} // end namespace bcc
+
+#endif  // BCC_SUPPORT_ATOMIC_OUTPUT_FILE_H
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_COMPILE_PASS_REPORT_H
+#define BCC_SUPPORT_COMPILE_PASS_REPORT_H
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class raw_ostream;
+}
+
+namespace bcc {
+
+// Cost and effect of every pass run by Compiler::runPasses(), in the order
+// they ran. Code generation is recorded as a single entry since its machine
+// function passes cannot be interleaved with module-level probes.
+class CompilePassReport {
+public:
+  struct Entry {
+    std::string mPassName;
+    // Wall-clock time, in seconds.
+    double mSeconds;
+    // Number of IR instructions and defined functions in the module before
+    // and after the pass.
+    unsigned mInstructionsBefore;
+    unsigned mInstructionsAfter;
+    unsigned mFunctionsBefore;
+    unsigned mFunctionsAfter;
+  };
+
+private:
+  std::vector<Entry> mEntries;
+
+public:
+  void reset()
+  { mEntries.clear(); }
+
+  void add(const Entry &pEntry)
+  { mEntries.push_back(pEntry); }
+
+  const std::vector<Entry> &getEntries() const
+  { return mEntries; }
+
+  // Returns the time spent in all passes, in seconds.
+  double getTotal() const;
+
+  // Print the entries as a JSON array of objects, one per pass.
+  void printJSON(llvm::raw_ostream &pOS) const;
+
+  // Print a human-readable table, the most expensive passes first.
+  void print(llvm::raw_ostream &pOS) const;
+};
+
+} // end namespace bcc
+
+#endif  // BCC_SUPPORT_COMPILE_PASS_REPORT_H
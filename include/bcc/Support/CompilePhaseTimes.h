@@ -0,0 +1,103 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_COMPILE_PHASE_TIMES_H
+#define BCC_SUPPORT_COMPILE_PHASE_TIMES_H
+
+#include <chrono>
+
+namespace llvm {
+  class raw_ostream;
+}
+
+namespace bcc {
+
+// Wall-clock time spent in each phase of a compilation.
+class CompilePhaseTimes {
+public:
+  enum Phase {
+    kLoad,          // Parsing the bitcode (lazily).
+    kMaterialize,   // Materializing the lazily loaded function bodies.
+    kScreen,        // Compiler::screenGlobalFunctions().
+    kLink,          // Linking with the runtime library.
+    kIRPasses,      // RS and LTO passes over the IR.
+    kCodeGen,       // Instruction selection through machine code emission.
+    kWrite,         // Flushing the object (and IR dump) to the output.
+
+    kNumPhases
+  };
+
+  static const char *GetPhaseName(Phase pPhase);
+
+private:
+  double mSeconds[kNumPhases];
+
+public:
+  CompilePhaseTimes() { reset(); }
+
+  void reset() {
+    for (unsigned i = 0; i < kNumPhases; i++) {
+      mSeconds[i] = 0;
+    }
+  }
+
+  void add(Phase pPhase, double pSeconds)
+  { mSeconds[pPhase] += pSeconds; }
+
+  // Returns the time spent in pPhase, in seconds.
+  double get(Phase pPhase) const
+  { return mSeconds[pPhase]; }
+
+  // Returns the time spent in all phases, in seconds.
+  double getTotal() const;
+
+  // Print the times as a JSON object mapping phase names to milliseconds,
+  // plus a "total" entry.
+  void printJSON(llvm::raw_ostream &pOS) const;
+};
+
+// Adds the time between its construction and its destruction (or stop()) to
+// a phase of a CompilePhaseTimes. Does nothing if no CompilePhaseTimes is
+// given.
+class ScopedPhaseTimer {
+private:
+  CompilePhaseTimes *mTimes;
+  CompilePhaseTimes::Phase mPhase;
+  std::chrono::steady_clock::time_point mStart;
+
+public:
+  ScopedPhaseTimer(CompilePhaseTimes *pTimes, CompilePhaseTimes::Phase pPhase)
+    : mTimes(pTimes), mPhase(pPhase) {
+    if (mTimes != nullptr) {
+      mStart = std::chrono::steady_clock::now();
+    }
+  }
+
+  void stop() {
+    if (mTimes != nullptr) {
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - mStart;
+      mTimes->add(mPhase, elapsed.count());
+      mTimes = nullptr;
+    }
+  }
+
+  ~ScopedPhaseTimer() { stop(); }
+};
+
+} // end namespace bcc
+
+#endif  // BCC_SUPPORT_COMPILE_PHASE_TIMES_H
@@ -33,6 +33,14 @@ class Target;
 namespace bcc {
 
 class CompilerConfig {
+public:
+  enum RegAllocKind {
+    kRegAllocDefault,  // Fast at -O0, greedy otherwise.
+    kRegAllocFast,
+    kRegAllocBasic,
+    kRegAllocGreedy
+  };
+
 private:
   //===--------------------------------------------------------------------===//
   // Available Configurations
@@ -53,6 +61,27 @@ private:
   // Are we set up to compile for full precision or something reduced?
   bool mFullPrecision;
 
+  // Should the loops left after LTO (mostly the expanded kernels) be
+  // unrolled and run through the SLP vectorizer?
+  bool mVectorize;
+
+  // Optimize with the pipeline tuned for RS scripts instead of LLVM's generic
+  // LTO pipeline?
+  bool mRSPipeline;
+
+  // Clone the expanded kernels for newer CPU variants of the architecture
+  // (see RSMultiVersion.h)?
+  bool mMultiVersion;
+
+  // Also expand kernels into functions over tiles of several rows (see
+  // RSExpandTile.h)?
+  bool mExpandTiles;
+
+  // Inlining threshold, or -1 for the default of the pipeline.
+  int mInlineThreshold;
+
+  RegAllocKind mRegAlloc;
+
   // The list of target specific features to enable or disable -- this should
   // be a list of strings starting with '+' (enable) or '-' (disable).
   std::string mFeatureString;
@@ -113,10 +142,51 @@ public:
     initializeArch();
   }
 
+  inline bool getVectorize() const
+  { return mVectorize; }
+  inline void setVectorize(bool pVectorize)
+  { mVectorize = pVectorize; }
+
+  inline bool getRSPipeline() const
+  { return mRSPipeline; }
+  inline void setRSPipeline(bool pRSPipeline)
+  { mRSPipeline = pRSPipeline; }
+
+  inline bool getMultiVersion() const
+  { return mMultiVersion; }
+  inline void setMultiVersion(bool pMultiVersion)
+  { mMultiVersion = pMultiVersion; }
+
+  inline bool getExpandTiles() const
+  { return mExpandTiles; }
+  inline void setExpandTiles(bool pExpandTiles)
+  { mExpandTiles = pExpandTiles; }
+
+  inline int getInlineThreshold() const
+  { return mInlineThreshold; }
+  inline void setInlineThreshold(int pInlineThreshold)
+  { mInlineThreshold = pInlineThreshold; }
+
+  inline RegAllocKind getRegAlloc() const
+  { return mRegAlloc; }
+  inline void setRegAlloc(RegAllocKind pRegAlloc)
+  { mRegAlloc = pRegAlloc; }
+
   inline const std::string &getFeatureString() const
   { return mFeatureString; }
   void setFeatureString(const std::vector<std::string> &pAttrs);
 
+  // Return a string that uniquely describes everything in this configuration
+  // that can affect the generated code. Two configurations with equal
+  // serializations produce identical objects from identical input.
+  std::string serialize() const;
+
+  // Return a string that describes only the part of this configuration that
+  // createTargetMachine() gets: the triple, CPU, features, TargetOptions,
+  // relocation and code models and optimization level. Configurations with
+  // equal target serializations can share a TargetMachine.
+  std::string serializeTarget() const;
+
   CompilerConfig(const std::string &pTriple);
 
   virtual ~CompilerConfig() { }
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SUPPORT_OBJECT_CACHE_H
+#define BCC_SUPPORT_OBJECT_CACHE_H
+
+#include <cstddef>
+#include <string>
+
+namespace bcc {
+
+// A content-addressed store of compiled objects. Each entry is a relocatable
+// object file named after a key (a hex digest) computed by the client over
+// every input that can affect the generated code. A later compilation with an
+// equal key can copy the stored object instead of running the compiler.
+//
+// Entries are published into the cache directory with an atomic rename, so
+// concurrent readers and writers (possibly in different processes) never see
+// a partially written entry. The cache never evicts entries by itself.
+class ObjectCache {
+private:
+  std::string mCacheDir;
+
+  std::string getEntryPath(const std::string &pKey) const;
+
+public:
+  ObjectCache(const std::string &pCacheDir);
+
+  const std::string &getCacheDir() const {
+    return mCacheDir;
+  }
+
+  // Copy the object stored under pKey to pOutputPath. Return false if there is
+  // no such entry or it could not be copied; pOutputPath should not be
+  // trusted in that case.
+  //
+  // pAtomicPublish must match how the caller's compiler writes pOutputPath
+  // (see RSCompilerDriver::setAtomicPublish()): rename a complete copy into
+  // place, or copy under the same FileMutex write lock.
+  bool retrieve(const std::string &pKey, const char *pOutputPath,
+                bool pAtomicPublish) const;
+
+  // Store the pObjectSize bytes of the object at pObject under pKey. Pass the
+  // object as the compiler produced it rather than reading back an output
+  // file, which a concurrent build may be rewriting. Failure to insert is
+  // not fatal to the caller; it only means a later lookup will miss.
+  bool insert(const std::string &pKey, const char *pObject,
+              size_t pObjectSize) const;
+};
+
+} // end namespace bcc
+
+#endif  // BCC_SUPPORT_OBJECT_CACHE_H
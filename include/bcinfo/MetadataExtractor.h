@@ -46,6 +46,39 @@ enum MetadataSignatureBitval {
 };
 
 class MetadataExtractor {
+ public:
+  // Describes one exported reduction kernel. The accumulator function has the
+  // form
+  //
+  //   void accumulator(AccumType *accum, In1 in1, ..., InN inN, <specials>)
+  //
+  // where <specials> are the special arguments (context, x, y, z) given by
+  // mSignature. The other functions are optional and may be null.
+  struct Reduce {
+    const char *mReduceName;
+    uint32_t mSignature;            // of the accumulator function
+    uint32_t mInputCount;           // of the accumulator function
+    uint32_t mAccumulatorDataSize;  // sizeof(AccumType), in bytes
+
+    const char *mInitializerName;   // void (AccumType *accum)
+    const char *mAccumulatorName;
+    const char *mCombinerName;      // void (AccumType *accum,
+                                    //       const AccumType *other)
+    const char *mOutConverterName;  // void (ResultType *result,
+                                    //       const AccumType *accum)
+
+    Reduce() : mReduceName(nullptr), mSignature(0), mInputCount(0),
+               mAccumulatorDataSize(0), mInitializerName(nullptr),
+               mAccumulatorName(nullptr), mCombinerName(nullptr),
+               mOutConverterName(nullptr) {
+    }
+    ~Reduce();
+
+   private:
+    Reduce(const Reduce &) = delete;
+    void operator=(const Reduce &) = delete;
+  };
+
  private:
   const llvm::Module *mModule;
   const char *mBitcode;
@@ -61,6 +94,9 @@ class MetadataExtractor {
 
   const uint32_t *mExportForEachInputCountList;
 
+  size_t mExportReduceCount;
+  const Reduce *mExportReduceList;
+
   size_t mPragmaCount;
   const char **mPragmaKeyList;
   const char **mPragmaValueList;
@@ -84,6 +120,7 @@ class MetadataExtractor {
   bool populateFuncNameMetadata(const llvm::NamedMDNode *FuncNameMetadata);
   bool populateForEachMetadata(const llvm::NamedMDNode *Names,
                                const llvm::NamedMDNode *Signatures);
+  bool populateReduceMetadata(const llvm::NamedMDNode *ReduceMetadata);
   bool populateObjectSlotMetadata(const llvm::NamedMDNode *ObjectSlotMetadata);
   void populatePragmaMetadata(const llvm::NamedMDNode *PragmaMetadata);
   void readThreadableFlag(const llvm::NamedMDNode *ThreadableMetadata);
@@ -183,6 +220,20 @@ class MetadataExtractor {
     return mExportForEachInputCountList;
   }
 
+  /**
+   * \return number of exported reduction kernels in this script/module.
+   */
+  size_t getExportReduceCount() const {
+    return mExportReduceCount;
+  }
+
+  /**
+   * \return array of exported reduction kernel descriptions.
+   */
+  const Reduce *getExportReduceList() const {
+    return mExportReduceList;
+  }
+
   /**
    * \return number of pragmas contained in pragmaKeyList and pragmaValueList.
    */
@@ -19,8 +19,14 @@
 #include <vector>
 
 #include <llvm/ADT/STLExtras.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include "bcc/Source.h"
+#include "bcc/Support/Log.h"
 
 using namespace bcc;
 
@@ -31,3 +37,58 @@ BCCContextImpl::~BCCContextImpl() {
   std::vector<Source *> Sources(mOwnSources.begin(), mOwnSources.end());
   llvm::DeleteContainerPointers(Sources);
 }
+
+const llvm::Module *
+BCCContextImpl::getRuntimeTemplate(const std::string &pPath) {
+  llvm::sys::fs::file_status status;
+  if (std::error_code ec = llvm::sys::fs::status(pPath, status)) {
+    ALOGE("Failed to stat runtime library %s! (%s)", pPath.c_str(),
+          ec.message().c_str());
+    return nullptr;
+  }
+
+  // Reuse the cached module unless the file was replaced since it was parsed.
+  std::map<std::string, RuntimeTemplate>::iterator cached =
+      mRuntimeTemplates.find(pPath);
+  if ((cached != mRuntimeTemplates.end()) &&
+      (cached->second.mModificationTime == status.getLastModificationTime()) &&
+      (cached->second.mSize == status.getSize())) {
+    return cached->second.mModule.get();
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> mb_or_error =
+      llvm::MemoryBuffer::getFile(pPath);
+  if (mb_or_error.getError()) {
+    ALOGE("Failed to load bitcode from path %s! (%s)", pPath.c_str(),
+          mb_or_error.getError().message().c_str());
+    return nullptr;
+  }
+
+  // The template is cloned for every script, so parse it completely rather
+  // than lazily.
+  llvm::ErrorOr<llvm::Module *> module_or_error =
+      llvm::parseBitcodeFile(mb_or_error.get()->getMemBufferRef(),
+                             mLLVMContext);
+  if (std::error_code ec = module_or_error.getError()) {
+    ALOGE("Unable to parse the given bitcode file `%s'! (%s)", pPath.c_str(),
+          ec.message().c_str());
+    return nullptr;
+  }
+  std::unique_ptr<llvm::Module> module(module_or_error.get());
+
+  // Verify once here; the copies handed out later are not verified again.
+  std::string error_info;
+  llvm::raw_string_ostream error_stream(error_info);
+  if (llvm::verifyModule(*module, &error_stream)) {
+    ALOGE("Bitcode of RenderScript module does not pass verification: `%s'!",
+          error_stream.str().c_str());
+    return nullptr;
+  }
+
+  RuntimeTemplate &entry = mRuntimeTemplates[pPath];
+  entry.mModificationTime = status.getLastModificationTime();
+  entry.mSize = status.getSize();
+  entry.mModule = std::move(module);
+
+  return entry.mModule.get();
+}
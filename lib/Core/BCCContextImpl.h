@@ -17,8 +17,14 @@
 #ifndef BCC_CORE_CONTEXT_IMPL_H
 #define BCC_CORE_CONTEXT_IMPL_H
 
+#include <map>
+#include <memory>
+#include <string>
+
 #include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/TimeValue.h>
 
 namespace bcc {
 
@@ -36,6 +42,22 @@ public:
   // automatically when this context is gone.
   llvm::SmallPtrSet<Source *, 2> mOwnSources;
 
+  // A fully materialized runtime library (e.g. libclcore.bc) together with the
+  // identity of the file it was parsed from.
+  struct RuntimeTemplate {
+    llvm::sys::TimeValue mModificationTime;
+    uint64_t mSize;
+    std::unique_ptr<llvm::Module> mModule;
+  };
+
+  // Parsed runtime libraries, keyed by path. Every script of this context is
+  // linked against a copy of one of these instead of re-parsing the file.
+  std::map<std::string, RuntimeTemplate> mRuntimeTemplates;
+
+  // Return the parsed runtime library at pPath, parsing it first if it is not
+  // cached yet or the file has changed since. Return nullptr on error.
+  const llvm::Module *getRuntimeTemplate(const std::string &pPath);
+
   BCCContextImpl(BCCContext &pContext) { }
   ~BCCContextImpl();
 };
@@ -18,9 +18,11 @@
 
 #include <llvm/Analysis/Passes.h>
 #include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/CodeGen/Passes.h>
 #include <llvm/CodeGen/RegAllocRegistry.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/IR/DataLayout.h>
@@ -32,20 +34,177 @@
 #include <llvm/Transforms/Vectorize.h>
 
 #include "bcc/Assert.h"
+#include "bcc/Renderscript/RSExpandReduce.h"
+#include "bcc/Renderscript/RSExpandTile.h"
+#include "bcc/Renderscript/RSProfile.h"
 #include "bcc/Renderscript/RSScript.h"
 #include "bcc/Renderscript/RSTransforms.h"
 #include "bcc/Script.h"
 #include "bcc/Source.h"
+#include "bcc/Support/CompilePassReport.h"
+#include "bcc/Support/CompilePhaseTimes.h"
 #include "bcc/Support/CompilerConfig.h"
 #include "bcc/Support/Log.h"
 #include "bcc/Support/OutputFile.h"
 #include "bcinfo/MetadataExtractor.h"
 #include "rsDefines.h"
 
+#include <chrono>
+#include <mutex>
 #include <string>
 
 using namespace bcc;
 
+namespace {
+
+// Guards the LLVM global state touched while setting up code generation.
+std::mutex gCodeGenSetupMutex;
+
+// Records when it is run. Placed between the IR passes and the code
+// generation passes, it splits the time of a single PassManager::run().
+class PhaseMarkerPass : public llvm::ModulePass {
+private:
+  std::chrono::steady_clock::time_point &mTime;
+
+public:
+  static char ID;
+
+  PhaseMarkerPass(std::chrono::steady_clock::time_point &pTime)
+    : ModulePass(ID), mTime(pTime) { }
+
+  virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override {
+    AU.setPreservesAll();
+  }
+
+  bool runOnModule(llvm::Module &M) override {
+    mTime = std::chrono::steady_clock::now();
+    return false;
+  }
+};
+
+char PhaseMarkerPass::ID = 0;
+
+//===----------------------------------------------------------------------===//
+// Pass instrumentation
+//===----------------------------------------------------------------------===//
+// What a PassProbe pair needs to hand over from before to after a pass.
+struct ProbeState {
+  std::chrono::steady_clock::time_point mStart;
+  unsigned mInstructions;
+  unsigned mFunctions;
+};
+
+void measureModule(const llvm::Module &pModule, unsigned &pInstructions,
+                   unsigned &pFunctions) {
+  pInstructions = 0;
+  pFunctions = 0;
+  for (const llvm::Function &F : pModule) {
+    if (F.isDeclaration()) {
+      continue;
+    }
+    pFunctions++;
+    for (const llvm::BasicBlock &BB : F) {
+      pInstructions += BB.size();
+    }
+  }
+}
+
+// Runs right before (mReport == nullptr) or right after a pass and records
+// its cost in mReport.
+class PassProbe : public llvm::ModulePass {
+private:
+  ProbeState &mState;
+  CompilePassReport *mReport;
+  std::string mPassName;
+
+public:
+  static char ID;
+
+  PassProbe(ProbeState &pState, CompilePassReport *pReport = nullptr,
+            const std::string &pPassName = "")
+    : ModulePass(ID), mState(pState), mReport(pReport),
+      mPassName(pPassName) { }
+
+  virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const override {
+    AU.setPreservesAll();
+  }
+
+  bool runOnModule(llvm::Module &M) override {
+    if (mReport == nullptr) {
+      measureModule(M, mState.mInstructions, mState.mFunctions);
+      // Start the clock last so that the measurement is not included.
+      mState.mStart = std::chrono::steady_clock::now();
+      return false;
+    }
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - mState.mStart;
+    CompilePassReport::Entry entry;
+    entry.mPassName = mPassName;
+    entry.mSeconds = elapsed.count();
+    entry.mInstructionsBefore = mState.mInstructions;
+    entry.mFunctionsBefore = mState.mFunctions;
+    measureModule(M, entry.mInstructionsAfter, entry.mFunctionsAfter);
+    mReport->add(entry);
+    return false;
+  }
+
+  virtual const char *getPassName() const override {
+    return "Renderscript Pass Probe";
+  }
+};
+
+char PassProbe::ID = 0;
+
+// A PassManager that, if given a CompilePassReport, brackets every pass it is
+// given with a pair of PassProbes. The analyses a pass requires are
+// scheduled right before it and so are accounted to it.
+//
+// The probes are module passes, so function and loop passes no longer share
+// a walk over the module; times are indicative of where compile time goes
+// rather than exact.
+class InstrumentedPassManager : public llvm::legacy::PassManager {
+private:
+  CompilePassReport *mReport;
+  ProbeState mState;
+  // Passes added between beginGroup() and endGroup() are recorded as one.
+  std::string mGroupName;
+
+public:
+  InstrumentedPassManager(CompilePassReport *pReport) : mReport(pReport) { }
+
+  void add(llvm::Pass *P) override {
+    // Immutable passes only provide information; they never run.
+    if ((mReport == nullptr) || !mGroupName.empty() ||
+        (P->getAsImmutablePass() != nullptr)) {
+      llvm::legacy::PassManager::add(P);
+      return;
+    }
+
+    const std::string name = P->getPassName();
+    llvm::legacy::PassManager::add(new PassProbe(mState));
+    llvm::legacy::PassManager::add(P);
+    llvm::legacy::PassManager::add(new PassProbe(mState, mReport, name));
+  }
+
+  void beginGroup(const std::string &pName) {
+    if (mReport != nullptr) {
+      llvm::legacy::PassManager::add(new PassProbe(mState));
+      mGroupName = pName;
+    }
+  }
+
+  void endGroup() {
+    if (mReport != nullptr) {
+      llvm::legacy::PassManager::add(new PassProbe(mState, mReport,
+                                                   mGroupName));
+      mGroupName.clear();
+    }
+  }
+};
+
+} // end anonymous namespace
+
 const char *Compiler::GetErrorString(enum ErrorCode pErrCode) {
   switch (pErrCode) {
   case kSuccess:
@@ -85,12 +244,31 @@ const char *Compiler::GetErrorString(enum ErrorCode pErrCode) {
 //===----------------------------------------------------------------------===//
 // Instance Methods
 //===----------------------------------------------------------------------===//
-Compiler::Compiler() : mTarget(nullptr), mEnableOpt(true) {
+Compiler::Compiler() : mTarget(nullptr), mEnableOpt(true),
+                       mEnableVectorize(false), mEnableRSPipeline(false),
+                       mEnableMultiVersion(false), mEnableExpandTiles(false),
+                       mEnableRelaxedFPMath(false),
+                       mInlineThreshold(-1),
+                       mRegAlloc(CompilerConfig::kRegAllocDefault),
+                       mTargetPoolHits(0), mTargetPoolMisses(0),
+                       mPhaseTimes(nullptr), mPassReport(nullptr) {
   return;
 }
 
 Compiler::Compiler(const CompilerConfig &pConfig) : mTarget(nullptr),
-                                                    mEnableOpt(true) {
+                                                    mEnableOpt(true),
+                                                    mEnableVectorize(false),
+                                                    mEnableRSPipeline(false),
+                                                    mEnableMultiVersion(false),
+                                                    mEnableExpandTiles(false),
+                                                    mEnableRelaxedFPMath(false),
+                                                    mInlineThreshold(-1),
+                                                    mRegAlloc(
+                                                      CompilerConfig::kRegAllocDefault),
+                                                    mTargetPoolHits(0),
+                                                    mTargetPoolMisses(0),
+                                                    mPhaseTimes(nullptr),
+                                                    mPassReport(nullptr) {
   const std::string &triple = pConfig.getTriple();
 
   enum ErrorCode err = config(pConfig);
@@ -108,6 +286,28 @@ enum Compiler::ErrorCode Compiler::config(const CompilerConfig &pConfig) {
     return kInvalidConfigNoTarget;
   }
 
+  mEnableVectorize = pConfig.getVectorize();
+  mEnableRSPipeline = pConfig.getRSPipeline();
+  mEnableMultiVersion = pConfig.getMultiVersion();
+  mEnableRelaxedFPMath = !pConfig.getFullPrecision();
+  mEnableExpandTiles = pConfig.getExpandTiles();
+  mInlineThreshold = pConfig.getInlineThreshold();
+  mRegAlloc = pConfig.getRegAlloc();
+
+  // Reuse the TargetMachine of an earlier configuration with the same target
+  // settings if we still have it. The other settings only affect the passes.
+  const std::string key = pConfig.serializeTarget();
+  for (TargetPool::iterator I = mTargetPool.begin(), E = mTargetPool.end();
+       I != E; ++I) {
+    if (I->first == key) {
+      mTargetPool.splice(mTargetPool.begin(), mTargetPool, I);
+      mTarget = I->second;
+      mTargetPoolHits++;
+      return kSuccess;
+    }
+  }
+  mTargetPoolMisses++;
+
   llvm::TargetMachine *new_target =
       (pConfig.getTarget())->createTargetMachine(pConfig.getTriple(),
                                                  pConfig.getCPU(),
@@ -122,31 +322,30 @@ enum Compiler::ErrorCode Compiler::config(const CompilerConfig &pConfig) {
                                    kErrCreateTargetMachine);
   }
 
-  // Replace the old TargetMachine.
-  delete mTarget;
+  // Make the new TargetMachine current and drop the least recently used one
+  // if the pool is full.
+  mTargetPool.push_front(std::make_pair(key, new_target));
   mTarget = new_target;
-
-  // Adjust register allocation policy according to the optimization level.
-  //  createFastRegisterAllocator: fast but bad quality
-  //  createLinearScanRegisterAllocator: not so fast but good quality
-  if ((pConfig.getOptimizationLevel() == llvm::CodeGenOpt::None)) {
-    llvm::RegisterRegAlloc::setDefault(llvm::createFastRegisterAllocator);
-  } else {
-    llvm::RegisterRegAlloc::setDefault(llvm::createGreedyRegisterAllocator);
+  if (mTargetPool.size() > kTargetPoolSize) {
+    delete mTargetPool.back().second;
+    mTargetPool.pop_back();
   }
 
   return kSuccess;
 }
 
 Compiler::~Compiler() {
-  delete mTarget;
+  for (TargetPool::iterator I = mTargetPool.begin(), E = mTargetPool.end();
+       I != E; ++I) {
+    delete I->second;
+  }
 }
 
 
 enum Compiler::ErrorCode Compiler::runPasses(Script &pScript,
                                              llvm::raw_pwrite_stream &pResult) {
   // Pass manager for link-time optimization
-  llvm::legacy::PassManager passes;
+  InstrumentedPassManager passes(mPassReport);
 
   // Empty MCContext.
   llvm::MCContext *mc_context = nullptr;
@@ -163,26 +362,43 @@ enum Compiler::ErrorCode Compiler::runPasses(Script &pScript,
     passes.add(llvm::createConstantMergePass());
 
   } else {
-    // FIXME: Figure out which passes should be executed.
-    llvm::PassManagerBuilder Builder;
-    Builder.Inliner = llvm::createFunctionInliningPass();
-    Builder.populateLTOPassManager(passes);
-
-    /* FIXME: Reenable autovectorization after rebase.
-       bug 19324423
-    // Add vectorization passes after LTO passes are in
-    // additional flag: -unroll-runtime
-    passes.add(llvm::createLoopUnrollPass(-1, 16, 0, 1));
-    // Need to pass appropriate flags here: -scalarize-load-store
-    passes.add(llvm::createScalarizerPass());
-    passes.add(llvm::createCFGSimplificationPass());
-    passes.add(llvm::createScopedNoAliasAAPass());
-    passes.add(llvm::createScalarEvolutionAliasAnalysisPass());
-    // additional flags: -slp-vectorize-hor -slp-vectorize-hor-store (unnecessary?)
-    passes.add(llvm::createSLPVectorizerPass());
-    passes.add(llvm::createDeadCodeEliminationPass());
-    passes.add(llvm::createInstructionCombiningPass());
-    */
+    if (mEnableRSPipeline) {
+      addRSOptimizationPasses(passes);
+    } else {
+      // FIXME: Figure out which passes should be executed.
+      llvm::PassManagerBuilder Builder;
+      Builder.Inliner = (mInlineThreshold >= 0) ?
+          llvm::createFunctionInliningPass(mInlineThreshold) :
+          llvm::createFunctionInliningPass();
+      Builder.populateLTOPassManager(passes);
+    }
+
+    // Clone the kernels once the kernel bodies and the runtime are inlined
+    // into them: the inliner refuses to inline across differing
+    // "target-features". The vectorizers below then see the TTI of each
+    // variant.
+    if (mEnableMultiVersion) {
+      passes.add(createRSMultiVersionPass(
+          mTarget->getTargetTriple().str(),
+          mTarget->getTargetFeatureString().str(), !mEnableRelaxedFPMath));
+    }
+
+    // Add vectorization passes after LTO passes are in, so that they see the
+    // expanded kernel loops with the kernel bodies inlined.
+    if (mEnableVectorize) {
+      // Unroll by up to 16 (also loops with a runtime trip count) to give the
+      // SLP vectorizer straight-line code to work with.
+      passes.add(llvm::createLoopUnrollPass(-1, 16, 0, 1));
+      // FIXME: -scalarize-load-store is only available as a command line
+      // option.
+      passes.add(llvm::createScalarizerPass());
+      passes.add(llvm::createCFGSimplificationPass());
+      passes.add(llvm::createScopedNoAliasAAPass());
+      passes.add(llvm::createScalarEvolutionAliasAnalysisPass());
+      passes.add(llvm::createSLPVectorizerPass());
+      passes.add(llvm::createDeadCodeEliminationPass());
+      passes.add(llvm::createInstructionCombiningPass());
+    }
   }
 
   // These passes have to come after LTO, since we don't want to examine
@@ -198,15 +414,82 @@ enum Compiler::ErrorCode Compiler::runPasses(Script &pScript,
   if (script.getEmbedInfo())
     passes.add(createRSEmbedInfoPass());
 
-  // Add passes to the pass manager to emit machine code through MC layer.
-  if (mTarget->addPassesToEmitMC(passes, mc_context, pResult,
-                                 /* DisableVerify */false)) {
-    return kPrepareCodeGenPass;
+  // Code generation runs on this thread for the whole module. Splitting the
+  // module per kernel and generating code for the parts in parallel would
+  // need the resulting objects to be combined into the single relocatable
+  // object the driver produces, and neither LLVM 3.7 (no splitCodeGen) nor
+  // this library has an in-process ELF linker to do that. Compile independent
+  // scripts in parallel with RSCompilerDriver::buildBatch() instead.
+  //
+  // For the same reason the object cache (see ObjectCache.h) keeps whole
+  // objects rather than the code of single functions. Reusing cached machine
+  // code would need the pieces relinked into one object, and after LTO
+  // (internalization, inlining of the runtime, global DCE) the code of a
+  // function depends on nearly the whole module anyway, so per-function
+  // entries would have to be keyed on it.
+
+  // Machine function passes must not be interleaved with the probes.
+  passes.beginGroup("Code Generation");
+
+  // Mark the end of the IR passes for the phase timer.
+  std::chrono::steady_clock::time_point codegen_start;
+  if (mPhaseTimes != nullptr) {
+    passes.add(new PhaseMarkerPass(codegen_start));
+  }
+
+  {
+    // The default register allocator is global state that is read while the
+    // code generation passes are constructed. Select it and construct them
+    // under one lock so that Compilers on different threads do not race.
+    std::lock_guard<std::mutex> codegen_setup_lock(gCodeGenSetupMutex);
+
+    // Adjust register allocation policy according to the configuration or
+    // else the optimization level.
+    //  createFastRegisterAllocator: fast but bad quality
+    //  createBasicRegisterAllocator: in between
+    //  createGreedyRegisterAllocator: not so fast but good quality
+    switch (mRegAlloc) {
+    case CompilerConfig::kRegAllocFast:
+      llvm::RegisterRegAlloc::setDefault(llvm::createFastRegisterAllocator);
+      break;
+    case CompilerConfig::kRegAllocBasic:
+      llvm::RegisterRegAlloc::setDefault(llvm::createBasicRegisterAllocator);
+      break;
+    case CompilerConfig::kRegAllocGreedy:
+      llvm::RegisterRegAlloc::setDefault(llvm::createGreedyRegisterAllocator);
+      break;
+    case CompilerConfig::kRegAllocDefault:
+    default:
+      if (mTarget->getOptLevel() == llvm::CodeGenOpt::None) {
+        llvm::RegisterRegAlloc::setDefault(llvm::createFastRegisterAllocator);
+      } else {
+        llvm::RegisterRegAlloc::setDefault(llvm::createGreedyRegisterAllocator);
+      }
+      break;
+    }
+
+    // Add passes to the pass manager to emit machine code through MC layer.
+    if (mTarget->addPassesToEmitMC(passes, mc_context, pResult,
+                                   /* DisableVerify */false)) {
+      return kPrepareCodeGenPass;
+    }
   }
 
+  passes.endGroup();
+
   // Execute the passes.
+  std::chrono::steady_clock::time_point passes_start =
+      std::chrono::steady_clock::now();
   passes.run(pScript.getSource().getModule());
 
+  if (mPhaseTimes != nullptr) {
+    std::chrono::duration<double> ir_time = codegen_start - passes_start;
+    std::chrono::duration<double> codegen_time =
+        std::chrono::steady_clock::now() - codegen_start;
+    mPhaseTimes->add(CompilePhaseTimes::kIRPasses, ir_time.count());
+    mPhaseTimes->add(CompilePhaseTimes::kCodeGen, codegen_time.count());
+  }
+
   return kSuccess;
 }
 
@@ -240,6 +523,7 @@ enum Compiler::ErrorCode Compiler::compile(Script &pScript,
     // A module with non-null materializer means that it is a lazy-load module.
     // Materialize it now via invoking MaterializeAllPermanently(). This
     // function returns false when the materialization is successful.
+    ScopedPhaseTimer timer(mPhaseTimes, CompilePhaseTimes::kMaterialize);
     std::error_code ec = module.materializeAllPermanently();
     if (ec) {
       ALOGE("Failed to materialize the module `%s'! (%s)",
@@ -253,6 +537,7 @@ enum Compiler::ErrorCode Compiler::compile(Script &pScript,
   }
 
   if (IRStream) {
+    ScopedPhaseTimer timer(mPhaseTimes, CompilePhaseTimes::kWrite);
     *IRStream << module;
   }
 
@@ -277,7 +562,10 @@ enum Compiler::ErrorCode Compiler::compile(Script &pScript,
   enum Compiler::ErrorCode err = compile(pScript, *out, IRStream);
 
   // Close the output before return.
-  delete out;
+  {
+    ScopedPhaseTimer timer(mPhaseTimes, CompilePhaseTimes::kWrite);
+    delete out;
+  }
 
   return err;
 }
@@ -286,12 +574,12 @@ bool Compiler::addInternalizeSymbolsPass(Script &pScript, llvm::legacy::PassMana
   // Add a pass to internalize the symbols that don't need to have global
   // visibility.
   RSScript &script = static_cast<RSScript &>(pScript);
-  llvm::Module &module = script.getSource().getModule();
-  bcinfo::MetadataExtractor me(&module);
-  if (!me.extract()) {
+  const bcinfo::MetadataExtractor *metadata = script.getSource().getMetadata();
+  if (metadata == nullptr) {
     bccAssert(false && "Could not extract metadata for module!");
     return false;
   }
+  const bcinfo::MetadataExtractor &me = *metadata;
 
   // The vector contains the symbols that should not be internalized.
   std::vector<const char *> export_symbols;
@@ -306,6 +594,12 @@ bool Compiler::addInternalizeSymbolsPass(Script &pScript, llvm::legacy::PassMana
     kRsGlobalAddresses,  // Optional global variable address info.
     kRsGlobalSizes,      // Optional global variable size info.
     kRsGlobalProperties, // Optional global variable properties.
+    kRsProfChecksum,     // Optional profile counters (see RSProfile.h).
+    kRsProfEntries,
+    kRsProfNames,
+    kRsProfCounters,
+    kRsProfSizes,
+    kRsExpandTileVersion, // Optional tiled kernels (see RSExpandTile.h).
     nullptr              // Must be nullptr-terminated.
   };
   const char **special_functions = sf;
@@ -343,7 +637,42 @@ bool Compiler::addInternalizeSymbolsPass(Script &pScript, llvm::legacy::PassMana
         std::string(exportForEachNameList[i]) + ".expand");
   }
 
-  for (i = 0; i < exportForEachCount; i++) {
+  // So should the tiled variants, which only pass-by-value kernels have.
+  if (mEnableExpandTiles) {
+    const uint32_t *exportForEachSignatureList =
+        me.getExportForEachSignatureList();
+    for (i = 0; i < exportForEachCount; ++i) {
+      if (bcinfo::MetadataExtractor::hasForEachSignatureKernel(
+              exportForEachSignatureList[i])) {
+        expanded_foreach_funcs.push_back(
+            std::string(exportForEachNameList[i]) + ".expand.tile");
+      }
+    }
+  }
+
+  // The same goes for the functions of reduction kernels that the runtime
+  // calls (see RSExpandReduce.h).
+  const bcinfo::MetadataExtractor::Reduce *exportReduceList =
+      me.getExportReduceList();
+  for (i = 0; i < me.getExportReduceCount(); ++i) {
+    const bcinfo::MetadataExtractor::Reduce &reduce = exportReduceList[i];
+    expanded_foreach_funcs.push_back(
+        std::string(reduce.mAccumulatorName) + ".expand");
+    if (reduce.mCombinerName) {
+      export_symbols.push_back(reduce.mCombinerName);
+    } else {
+      expanded_foreach_funcs.push_back(
+          std::string(reduce.mAccumulatorName) + kRsReduceCombinerSuffix);
+    }
+    if (reduce.mInitializerName) {
+      export_symbols.push_back(reduce.mInitializerName);
+    }
+    if (reduce.mOutConverterName) {
+      export_symbols.push_back(reduce.mOutConverterName);
+    }
+  }
+
+  for (i = 0; i < expanded_foreach_funcs.size(); i++) {
       export_symbols.push_back(expanded_foreach_funcs[i].c_str());
   }
 
@@ -363,7 +692,31 @@ bool Compiler::addInvokeHelperPass(llvm::legacy::PassManager &pPM) {
 bool Compiler::addExpandForEachPass(Script &pScript, llvm::legacy::PassManager &pPM) {
   // Expand ForEach on CPU path to reduce launch overhead.
   bool pEnableStepOpt = true;
-  pPM.add(createRSForEachExpandPass(pEnableStepOpt));
+  // Widened kernel loops are only worth their code size if the SLP
+  // vectorizer runs later on.
+  bool pWidenKernelLoops = mEnableVectorize &&
+      (mTarget->getOptLevel() != llvm::CodeGenOpt::None);
+  // None of the passes that run before it change the RS metadata, so it can
+  // use the metadata cached by the source.
+  pPM.add(createRSForEachExpandPass(pEnableStepOpt,
+                                    pScript.getSource().getMetadata(),
+                                    pWidenKernelLoops, mEnableExpandTiles));
+
+  return true;
+}
+
+bool Compiler::addProfilePass(Script &pScript, llvm::legacy::PassManager &pPM) {
+  // Instrument or annotate the kernels and the script functions they call.
+  // This must come right after ForEach expansion in both cases so that the
+  // counters of an instrumented build line up with the branches seen when
+  // the profile is used.
+  RSScript &script = static_cast<RSScript &>(pScript);
+  if (script.getProfileInstrument()) {
+    pPM.add(createRSProfileInstrumentPass(script.getScriptFunctions()));
+  } else if (script.getProfile() != nullptr) {
+    pPM.add(createRSProfileAnnotatePass(*script.getProfile(),
+                                        script.getScriptFunctions()));
+  }
 
   return true;
 }
@@ -386,6 +739,16 @@ bool Compiler::addInvariantPass(llvm::legacy::PassManager &pPM) {
   return true;
 }
 
+bool Compiler::addFastMathPass(llvm::legacy::PassManager &pPM) {
+  // Relax the floating point operations of rs_fp_relaxed scripts. Should run
+  // after ExpandForEach and before inlining.
+  if (mEnableRelaxedFPMath) {
+    pPM.add(createRSFastMathPass());
+  }
+
+  return true;
+}
+
 bool Compiler::addCustomPasses(Script &pScript, llvm::legacy::PassManager &pPM) {
   if (!addInvokeHelperPass(pPM))
     return false;
@@ -393,9 +756,15 @@ bool Compiler::addCustomPasses(Script &pScript, llvm::legacy::PassManager &pPM)
   if (!addExpandForEachPass(pScript, pPM))
     return false;
 
+  if (!addProfilePass(pScript, pPM))
+    return false;
+
   if (!addInvariantPass(pPM))
     return false;
 
+  if (!addFastMathPass(pPM))
+    return false;
+
   if (!addInternalizeSymbolsPass(pScript, pPM))
     return false;
 
@@ -405,6 +774,64 @@ bool Compiler::addCustomPasses(Script &pScript, llvm::legacy::PassManager &pPM)
   return true;
 }
 
+void Compiler::addRSOptimizationPasses(llvm::legacy::PassManager &pPM) {
+  // A script is a handful of kernels and invokables linked against the
+  // runtime library, with everything but the exported symbols internalized
+  // by addCustomPasses(). Unlike populateLTOPassManager(), which is meant for
+  // whole programs, this pipeline leaves out the interprocedural analyses
+  // that have little to work with here (argument promotion, function
+  // attributes, IPSCCP, ...) and spends the time on the expanded kernel loops
+  // instead.
+
+  // Alias analyses. RSForEachExpandPass emits TBAA metadata for allocations.
+  pPM.add(llvm::createTypeBasedAliasAnalysisPass());
+  pPM.add(llvm::createScopedNoAliasAAPass());
+  pPM.add(llvm::createBasicAliasAnalysisPass());
+
+  // Drop the runtime functions the script never calls before doing any work
+  // on them.
+  pPM.add(llvm::createGlobalDCEPass());
+  pPM.add(llvm::createGlobalOptimizerPass());
+  pPM.add(llvm::createPromoteMemoryToRegisterPass());
+  pPM.add(llvm::createInstructionCombiningPass());
+  pPM.add(llvm::createCFGSimplificationPass());
+
+  // Runtime functions are small; inline them (and the kernels) into the
+  // .expand loops so that the loop passes see the whole body. The threshold
+  // is a starting point, not a measured optimum: it has not been compared
+  // with others (bcc -rs-inline-threshold) or with the generic pipeline on
+  // real scripts yet, which is why this pipeline is opt-in. Use
+  // tests/pipeline/compare_pipelines.sh to do so.
+  const int kRSInlineThreshold = 1000;
+  pPM.add(llvm::createFunctionInliningPass(
+      (mInlineThreshold >= 0) ? mInlineThreshold : kRSInlineThreshold));
+  pPM.add(llvm::createGlobalDCEPass());
+
+  // Clean up the inlined bodies.
+  pPM.add(llvm::createSROAPass());
+  pPM.add(llvm::createEarlyCSEPass());
+  pPM.add(llvm::createInstructionCombiningPass());
+  pPM.add(llvm::createJumpThreadingPass());
+  pPM.add(llvm::createCFGSimplificationPass());
+  pPM.add(llvm::createReassociatePass());
+
+  // The expanded kernel loops.
+  pPM.add(llvm::createLoopRotatePass());
+  pPM.add(llvm::createLICMPass());
+  pPM.add(llvm::createIndVarSimplifyPass());
+  pPM.add(llvm::createLoopDeletionPass());
+
+  // Redundancies exposed by the above.
+  pPM.add(llvm::createGVNPass());
+  pPM.add(llvm::createMemCpyOptPass());
+  pPM.add(llvm::createDeadStoreEliminationPass());
+  pPM.add(llvm::createInstructionCombiningPass());
+  pPM.add(llvm::createCFGSimplificationPass());
+
+  pPM.add(llvm::createGlobalDCEPass());
+  pPM.add(llvm::createConstantMergePass());
+}
+
 bool Compiler::addPostLTOCustomPasses(llvm::legacy::PassManager &pPM) {
   // Add pass to correct calling convention for X86-64.
   llvm::Triple arch(getTargetMachine().getTargetTriple());
@@ -424,6 +851,7 @@ enum Compiler::ErrorCode Compiler::screenGlobalFunctions(Script &pScript) {
   // clear the materializer by calling materializeAllPermanently since the
   // runtime library has not been merged into the module yet.
   if (module.getMaterializer() != nullptr) {
+    ScopedPhaseTimer timer(mPhaseTimes, CompilePhaseTimes::kMaterialize);
     std::error_code ec = module.materializeAll();
     if (ec) {
       ALOGE("Failed to materialize module `%s' when screening globals! (%s)",
@@ -433,6 +861,7 @@ enum Compiler::ErrorCode Compiler::screenGlobalFunctions(Script &pScript) {
   }
 
   // Add pass to check for illegal function calls.
+  ScopedPhaseTimer timer(mPhaseTimes, CompilePhaseTimes::kScreen);
   llvm::legacy::PassManager pPM;
   pPM.add(createRSScreenFunctionsPass());
   pPM.run(module);
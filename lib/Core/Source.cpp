@@ -18,16 +18,23 @@
 
 #include <new>
 
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/IR/Constants.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Linker/Linker.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include "llvm/Support/raw_ostream.h"
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 
 #include "bcc/BCCContext.h"
 #include "bcc/Support/Log.h"
+#include "bcinfo/MetadataExtractor.h"
 
 #include "BCCContextImpl.h"
 
@@ -48,6 +55,234 @@ static inline llvm::Module *helper_load_bitcode(llvm::LLVMContext &pContext,
   return moduleOrError.get();
 }
 
+// Collect the globals that pC refers to, looking through constant
+// expressions and aggregates.
+void collectGlobals(const llvm::Constant *pC,
+                    llvm::SmallPtrSetImpl<const llvm::GlobalValue *> &pGlobals,
+                    llvm::SmallPtrSetImpl<const llvm::Constant *> &pVisited) {
+  if (const llvm::GlobalValue *GV = llvm::dyn_cast<llvm::GlobalValue>(pC)) {
+    pGlobals.insert(GV);
+    return;
+  }
+  if (!pVisited.insert(pC).second) {
+    return;
+  }
+  for (const llvm::Use &Op : pC->operands()) {
+    collectGlobals(llvm::cast<llvm::Constant>(Op.get()), pGlobals, pVisited);
+  }
+}
+
+// Copies the part of a module that is reachable from a set of root globals.
+// This is used to import just the needed functions of the (large) runtime
+// library into a script instead of linking all of it and having internalize
+// and GlobalDCE throw most of it away again.
+class ReachableGlobalsCloner {
+private:
+  const llvm::Module &mSource;
+
+  llvm::SmallPtrSet<const llvm::GlobalValue *, 64> mReachable;
+  llvm::SmallVector<const llvm::GlobalValue *, 64> mWorklist;
+  llvm::SmallPtrSet<const llvm::Constant *, 64> mVisitedConstants;
+
+  void addGlobal(const llvm::GlobalValue *pGV) {
+    if (mReachable.insert(pGV).second) {
+      mWorklist.push_back(pGV);
+    }
+  }
+
+  void addConstant(const llvm::Constant *pC) {
+    llvm::SmallPtrSet<const llvm::GlobalValue *, 8> globals;
+    collectGlobals(pC, globals, mVisitedConstants);
+    for (const llvm::GlobalValue *GV : globals) {
+      addGlobal(GV);
+    }
+  }
+
+  void addReferences(const llvm::GlobalValue *pGV) {
+    if (const llvm::Function *F = llvm::dyn_cast<llvm::Function>(pGV)) {
+      if (F->hasPersonalityFn()) {
+        addConstant(F->getPersonalityFn());
+      }
+      for (const llvm::BasicBlock &BB : *F) {
+        for (const llvm::Instruction &I : BB) {
+          for (const llvm::Use &Op : I.operands()) {
+            if (const llvm::Constant *C =
+                    llvm::dyn_cast<llvm::Constant>(Op.get())) {
+              addConstant(C);
+            }
+          }
+        }
+      }
+    } else if (const llvm::GlobalVariable *GV =
+                   llvm::dyn_cast<llvm::GlobalVariable>(pGV)) {
+      if (GV->hasInitializer()) {
+        addConstant(GV->getInitializer());
+      }
+    } else if (const llvm::GlobalAlias *GA =
+                   llvm::dyn_cast<llvm::GlobalAlias>(pGV)) {
+      if (GA->getAliasee() != nullptr) {
+        addConstant(GA->getAliasee());
+      }
+    }
+  }
+
+  // Return true if pMD (transitively) refers to a global that is not copied.
+  bool refersToDropped(const llvm::Metadata *pMD,
+                       llvm::SmallPtrSetImpl<const llvm::Metadata *> &pSeen) {
+    if ((pMD == nullptr) || !pSeen.insert(pMD).second) {
+      return false;
+    }
+    if (const llvm::MDNode *N = llvm::dyn_cast<llvm::MDNode>(pMD)) {
+      for (const llvm::MDOperand &Op : N->operands()) {
+        if (refersToDropped(Op.get(), pSeen)) {
+          return true;
+        }
+      }
+    } else if (const llvm::ConstantAsMetadata *C =
+                   llvm::dyn_cast<llvm::ConstantAsMetadata>(pMD)) {
+      llvm::SmallPtrSet<const llvm::GlobalValue *, 8> globals;
+      llvm::SmallPtrSet<const llvm::Constant *, 8> visited;
+      collectGlobals(C->getValue(), globals, visited);
+      for (const llvm::GlobalValue *GV : globals) {
+        if (!mReachable.count(GV)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+public:
+  ReachableGlobalsCloner(const llvm::Module &pSource) : mSource(pSource) { }
+
+  void addRoot(llvm::StringRef pName) {
+    const llvm::GlobalValue *GV = mSource.getNamedValue(pName);
+    if (GV != nullptr) {
+      addGlobal(GV);
+    }
+  }
+
+  llvm::Module *clone() {
+    // Appending globals (llvm.used, llvm.global_ctors, ...) are always kept,
+    // as a full link would.
+    for (const llvm::GlobalVariable &GV : mSource.globals()) {
+      if (GV.hasAppendingLinkage()) {
+        addGlobal(&GV);
+      }
+    }
+
+    while (!mWorklist.empty()) {
+      const llvm::GlobalValue *GV = mWorklist.pop_back_val();
+      addReferences(GV);
+    }
+
+    llvm::Module *New = new (std::nothrow) llvm::Module(
+        mSource.getModuleIdentifier(), mSource.getContext());
+    if (New == nullptr) {
+      return nullptr;
+    }
+    New->setDataLayout(mSource.getDataLayout());
+    New->setTargetTriple(mSource.getTargetTriple());
+    New->setModuleInlineAsm(mSource.getModuleInlineAsm());
+
+    // Create the copied globals first, so that bodies and initializers can
+    // refer to them in any order. This follows llvm::CloneModule().
+    llvm::ValueToValueMapTy VMap;
+
+    for (const llvm::GlobalVariable &I : mSource.globals()) {
+      if (!mReachable.count(&I)) {
+        continue;
+      }
+      llvm::GlobalVariable *GV = new llvm::GlobalVariable(
+          *New, I.getType()->getElementType(), I.isConstant(),
+          I.getLinkage(), nullptr, I.getName(), nullptr,
+          I.getThreadLocalMode(), I.getType()->getAddressSpace());
+      GV->copyAttributesFrom(&I);
+      VMap[&I] = GV;
+    }
+
+    for (const llvm::Function &I : mSource) {
+      if (!mReachable.count(&I)) {
+        continue;
+      }
+      llvm::Function *F = llvm::Function::Create(
+          llvm::cast<llvm::FunctionType>(I.getType()->getElementType()),
+          I.getLinkage(), I.getName(), New);
+      F->copyAttributesFrom(&I);
+      VMap[&I] = F;
+    }
+
+    for (const llvm::GlobalAlias &I : mSource.aliases()) {
+      if (!mReachable.count(&I)) {
+        continue;
+      }
+      llvm::GlobalAlias *GA = llvm::GlobalAlias::create(
+          llvm::cast<llvm::PointerType>(I.getType()), I.getLinkage(),
+          I.getName(), New);
+      GA->copyAttributesFrom(&I);
+      VMap[&I] = GA;
+    }
+
+    for (const llvm::GlobalVariable &I : mSource.globals()) {
+      if (mReachable.count(&I) && I.hasInitializer()) {
+        llvm::cast<llvm::GlobalVariable>(VMap[&I])->setInitializer(
+            llvm::MapValue(I.getInitializer(), VMap));
+      }
+    }
+
+    for (const llvm::Function &I : mSource) {
+      if (!mReachable.count(&I) || I.isDeclaration()) {
+        continue;
+      }
+      llvm::Function *F = llvm::cast<llvm::Function>(VMap[&I]);
+
+      llvm::Function::arg_iterator DestI = F->arg_begin();
+      for (const llvm::Argument &J : I.args()) {
+        DestI->setName(J.getName());
+        VMap[&J] = &*DestI++;
+      }
+
+      llvm::SmallVector<llvm::ReturnInst *, 8> Returns;
+      llvm::CloneFunctionInto(F, &I, VMap, /* ModuleLevelChanges */ true,
+                              Returns);
+
+      if (I.hasPersonalityFn()) {
+        F->setPersonalityFn(llvm::MapValue(I.getPersonalityFn(), VMap));
+      }
+    }
+
+    for (const llvm::GlobalAlias &I : mSource.aliases()) {
+      if (mReachable.count(&I) && (I.getAliasee() != nullptr)) {
+        llvm::cast<llvm::GlobalAlias>(VMap[&I])->setAliasee(
+            llvm::MapValue(I.getAliasee(), VMap));
+      }
+    }
+
+    // Named metadata (module flags, ident, ...) is copied unless it refers to
+    // a global that has been left out.
+    for (const llvm::NamedMDNode &NMD : mSource.named_metadata()) {
+      bool dropped = false;
+      llvm::SmallPtrSet<const llvm::Metadata *, 16> seen;
+      for (unsigned i = 0, e = NMD.getNumOperands(); i != e; ++i) {
+        if (refersToDropped(NMD.getOperand(i), seen)) {
+          dropped = true;
+          break;
+        }
+      }
+      if (dropped) {
+        continue;
+      }
+
+      llvm::NamedMDNode *NewNMD = New->getOrInsertNamedMetadata(NMD.getName());
+      for (unsigned i = 0, e = NMD.getNumOperands(); i != e; ++i) {
+        NewNMD->addOperand(llvm::MapMetadata(NMD.getOperand(i), VMap));
+      }
+    }
+
+    return New;
+  }
+};
+
 } // end anonymous namespace
 
 namespace bcc {
@@ -55,6 +290,7 @@ namespace bcc {
 void Source::setModule(llvm::Module *pModule) {
   if (!mNoDelete && (mModule != pModule)) delete mModule;
   mModule = pModule;
+  invalidateMetadata();
 }
 
 Source *Source::CreateFromBuffer(BCCContext &pContext,
@@ -110,6 +346,45 @@ Source *Source::CreateFromFile(BCCContext &pContext, const std::string &pPath) {
   return result;
 }
 
+Source *Source::CreateFromRuntimeFile(
+    BCCContext &pContext, const std::string &pPath,
+    const std::vector<std::string> *pImports) {
+  const llvm::Module *runtime = pContext.mImpl->getRuntimeTemplate(pPath);
+  if (runtime == nullptr) {
+    return nullptr;
+  }
+
+  llvm::Module *module = nullptr;
+  // Debug information can tie any function of the library to any other one,
+  // so a library that carries it is always copied in full.
+  if ((pImports != nullptr) &&
+      (runtime->getNamedMetadata("llvm.dbg.cu") == nullptr)) {
+    ReachableGlobalsCloner cloner(*runtime);
+    for (const std::string &name : *pImports) {
+      cloner.addRoot(name);
+    }
+    module = cloner.clone();
+  } else {
+    module = llvm::CloneModule(runtime);
+  }
+  if (module == nullptr) {
+    ALOGE("Out of memory when copying runtime library `%s'!", pPath.c_str());
+    return nullptr;
+  }
+
+  // The template has been verified when it was parsed, so bypass
+  // CreateFromModule() and its verifier run.
+  Source *result = new (std::nothrow) Source(pPath.c_str(), pContext, *module,
+                                             /* pNoDelete */false);
+  if (result == nullptr) {
+    ALOGE("Out of memory during Source object allocation for `%s'!",
+          pPath.c_str());
+    delete module;
+  }
+
+  return result;
+}
+
 Source *Source::CreateFromModule(BCCContext &pContext, const char* name, llvm::Module &pModule,
                                  bool pNoDelete) {
   std::string ErrorInfo;
@@ -130,11 +405,13 @@ Source *Source::CreateFromModule(BCCContext &pContext, const char* name, llvm::M
 
 Source::Source(const char* name, BCCContext &pContext, llvm::Module &pModule,
                bool pNoDelete)
-    : mName(name), mContext(pContext), mModule(&pModule), mNoDelete(pNoDelete) {
+    : mName(name), mContext(pContext), mModule(&pModule), mNoDelete(pNoDelete),
+      mMetadata(nullptr) {
     pContext.addSource(*this);
 }
 
 Source::~Source() {
+  invalidateMetadata();
   mContext.removeSource(*this);
   if (!mNoDelete)
     delete mModule;
@@ -148,6 +425,9 @@ bool Source::merge(Source &pSource) {
     return false;
   }
 
+  // pSource may have brought in metadata of its own.
+  invalidateMetadata();
+
   return true;
 }
 
@@ -179,6 +459,29 @@ void Source::addBuildChecksumMetadata(const char *buildChecksum) const {
     llvm::NamedMDNode *node =
         mModule->getOrInsertNamedMetadata("#rs_build_checksum");
     node->addOperand(llvm::MDNode::get(context, val));
+    invalidateMetadata();
+}
+
+const bcinfo::MetadataExtractor *Source::getMetadata() const {
+  if (mMetadata == nullptr) {
+    bcinfo::MetadataExtractor *metadata =
+        new (std::nothrow) bcinfo::MetadataExtractor(mModule);
+    if (metadata == nullptr) {
+      return nullptr;
+    }
+    if (!metadata->extract()) {
+      ALOGE("Could not extract RS metadata from `%s'!", mName.c_str());
+      delete metadata;
+      return nullptr;
+    }
+    mMetadata = metadata;
+  }
+  return mMetadata;
+}
+
+void Source::invalidateMetadata() const {
+  delete mMetadata;
+  mMetadata = nullptr;
 }
 
 } // namespace bcc
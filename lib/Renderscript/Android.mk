@@ -24,9 +24,13 @@ LOCAL_PATH := $(call my-dir)
 libbcc_renderscript_SRC_FILES := \
   RSCompilerDriver.cpp \
   RSEmbedInfo.cpp \
+  RSFastMathPass.cpp \
   RSForEachExpand.cpp \
   RSGlobalInfoPass.cpp \
   RSInvariant.cpp \
+  RSMultiVersionPass.cpp \
+  RSProfile.cpp \
+  RSProfilePass.cpp \
   RSScript.cpp \
   RSInvokeHelperPass.cpp \
   RSIsThreadablePass.cpp \
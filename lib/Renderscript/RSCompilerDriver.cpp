@@ -16,10 +16,13 @@
 
 #include "bcc/Renderscript/RSCompilerDriver.h"
 
+#include <llvm/ADT/SmallVector.h>
 #include "llvm/IR/AssemblyAnnotationWriter.h"
 #include <llvm/IR/Module.h>
 #include "llvm/Linker/Linker.h"
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/Path.h>
 #include <llvm/Support/raw_ostream.h>
 
@@ -31,33 +34,63 @@
 #include "bcc/Config/Config.h"
 #include "bcc/Renderscript/RSScript.h"
 #include "bcc/Renderscript/RSScriptGroupFusion.h"
+#include "bcc/Support/AtomicOutputFile.h"
 #include "bcc/Support/CompilerConfig.h"
 #include "bcc/Source.h"
 #include "bcc/Support/FileMutex.h"
 #include "bcc/Support/Log.h"
 #include "bcc/Support/InputFile.h"
 #include "bcc/Support/Initialization.h"
+#include "bcc/Support/ObjectCache.h"
 #include "bcc/Support/OutputFile.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+
+#include <sys/types.h>
 
 #ifdef HAVE_ANDROID_OS
 #include <cutils/properties.h>
 #endif
-#include <utils/StopWatch.h>
+
+#ifndef USE_MINGW
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace bcc;
 
 RSCompilerDriver::RSCompilerDriver(bool pUseCompilerRT) :
     mConfig(nullptr), mCompiler(), mDebugContext(false),
     mLinkRuntimeCallback(nullptr), mEnableGlobalMerge(true),
-    mEmbedGlobalInfo(false), mEmbedGlobalInfoSkipConstant(false) {
+    mEmbedGlobalInfo(false), mEmbedGlobalInfoSkipConstant(false),
+    mSelectiveRuntimeImport(false), mAtomicPublish(false),
+    mInstrumentPasses(false), mVectorizeMode(kVectorizeRelaxed),
+    mUseRSPipeline(false), mInlineThreshold(-1), mMultiVersionKernels(false),
+    mExpandTiles(false), mProfileInstrument(false), mCompileBudget(0),
+    mObjectCache(nullptr),
+    mOptimizedTierProcess(false) {
   init::Initialize();
+  mCompiler.setPhaseTimes(&mPhaseTimes);
 }
 
-RSCompilerDriver::~RSCompilerDriver() {
-  delete mConfig;
+void RSCompilerDriver::setObjectCacheDir(const char *pCacheDir) {
+  delete mObjectCache;
+  mObjectCache = nullptr;
+
+  if (pCacheDir != nullptr) {
+    mObjectCache = new (std::nothrow) ObjectCache(pCacheDir);
+  }
 }
 
 
@@ -72,7 +105,11 @@ bool RSCompilerDriver::setupConfig(const RSScript &pScript) {
       static_cast<llvm::CodeGenOpt::Level>(pScript.getOptimizationLevel());
 
 #if defined(PROVIDE_ARM_CODEGEN)
-  EnableGlobalMerge = mEnableGlobalMerge;
+  // Only write the global option when it changes; buildBatch() relies on
+  // this to keep its worker threads from racing on it.
+  if (EnableGlobalMerge != mEnableGlobalMerge) {
+    EnableGlobalMerge = mEnableGlobalMerge;
+  }
 #endif
 
   if (mConfig != nullptr) {
@@ -93,27 +130,133 @@ bool RSCompilerDriver::setupConfig(const RSScript &pScript) {
     changed = true;
   }
 
-#if defined(PROVIDE_ARM_CODEGEN)
-  bcinfo::MetadataExtractor me(&pScript.getSource().getModule());
-  if (!me.extract()) {
+  const bcinfo::MetadataExtractor *me = pScript.getSource().getMetadata();
+  if (me == nullptr) {
     assert("Could not extract RS pragma metadata for module!");
   }
+  const bcinfo::RSFloatPrecision script_precision =
+      (me != nullptr) ? me->getRSFloatPrecision() : bcinfo::RS_FP_Full;
 
-  bool script_full_prec = (me.getRSFloatPrecision() == bcinfo::RS_FP_Full);
+  // Besides the fast-math flags, this selects NEON on ARM and fused
+  // multiply-adds on every architecture for relaxed scripts.
+  bool script_full_prec = (script_precision == bcinfo::RS_FP_Full);
   if (mConfig->getFullPrecision() != script_full_prec) {
     mConfig->setFullPrecision(script_full_prec);
     changed = true;
   }
-#endif
+
+  // Unrolling and SLP vectorization may reassociate floating point
+  // operations, which only rs_fp_relaxed scripts allow by default.
+  bool script_vectorize;
+  switch (mVectorizeMode) {
+  case kVectorizeAlways:
+    script_vectorize = true;
+    break;
+  case kVectorizeNever:
+    script_vectorize = false;
+    break;
+  case kVectorizeRelaxed:
+  default:
+    script_vectorize = (script_precision == bcinfo::RS_FP_Relaxed);
+    break;
+  }
+  if (mConfig->getVectorize() != script_vectorize) {
+    mConfig->setVectorize(script_vectorize);
+    changed = true;
+  }
+
+  if (mConfig->getRSPipeline() != mUseRSPipeline) {
+    mConfig->setRSPipeline(mUseRSPipeline);
+    changed = true;
+  }
+
+  if (mConfig->getMultiVersion() != mMultiVersionKernels) {
+    mConfig->setMultiVersion(mMultiVersionKernels);
+    changed = true;
+  }
+
+  if (mConfig->getExpandTiles() != mExpandTiles) {
+    mConfig->setExpandTiles(mExpandTiles);
+    changed = true;
+  }
+
+  if (mConfig->getInlineThreshold() != pScript.getInlineThreshold()) {
+    mConfig->setInlineThreshold(pScript.getInlineThreshold());
+    changed = true;
+  }
+
+  if (mConfig->getRegAlloc() != pScript.getRegAlloc()) {
+    mConfig->setRegAlloc(pScript.getRegAlloc());
+    changed = true;
+  }
 
   return changed;
 }
 
-Compiler::ErrorCode RSCompilerDriver::compileScript(RSScript& pScript, const char* pScriptName,
-                                                    const char* pOutputPath,
-                                                    const char* pRuntimePath,
-                                                    const char* pBuildChecksum,
-                                                    bool pDumpIR) {
+bool RSCompilerDriver::computeObjectCacheKey(const char *pBitcode,
+                                             size_t pBitcodeSize,
+                                             const char *pBuildChecksum,
+                                             const char *pRuntimePath,
+                                             std::string &pKey) const {
+  if ((mConfig == nullptr) || (pRuntimePath == nullptr)) {
+    return false;
+  }
+
+  // The runtime library is linked into every script, so its contents are as
+  // much an input as the script bitcode itself.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer> > runtime =
+      llvm::MemoryBuffer::getFile(pRuntimePath, -1,
+                                  /* RequiresNullTerminator */ false);
+  if (!runtime) {
+    return false;
+  }
+
+  llvm::MD5 hash;
+
+  // Every field is length-prefixed so that adjacent fields cannot alias.
+  auto addField = [&hash](llvm::StringRef pData) {
+    uint64_t size = pData.size();
+    hash.update(llvm::ArrayRef<uint8_t>(
+        reinterpret_cast<const uint8_t *>(&size), sizeof(size)));
+    hash.update(pData);
+  };
+
+  addField(llvm::StringRef(pBitcode, pBitcodeSize));
+  addField((*runtime)->getBuffer());
+  addField(mConfig->serialize());
+  addField((pBuildChecksum != nullptr) ? pBuildChecksum : "");
+
+  std::stringstream flags;
+  flags << "debug=" << mDebugContext
+        << ";globalmerge=" << mEnableGlobalMerge
+        << ";globalinfo=" << mEmbedGlobalInfo
+        << ";globalinfoskipconst=" << mEmbedGlobalInfoSkipConstant
+        << ";selectiveimport=" << mSelectiveRuntimeImport
+        << ";profileinstrument=" << mProfileInstrument;
+  addField(flags.str());
+
+  // The profile is as much an input as the bitcode when it is used.
+  if (!mProfileInstrument && !mProfilePath.empty()) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer> > profile =
+        llvm::MemoryBuffer::getFile(mProfilePath, -1,
+                                    /* RequiresNullTerminator */ false);
+    addField(profile ? (*profile)->getBuffer() : "");
+  }
+
+  llvm::MD5::MD5Result result;
+  hash.final(result);
+
+  llvm::SmallString<32> digest;
+  llvm::MD5::stringifyResult(result, digest);
+  pKey = digest.str();
+
+  return true;
+}
+
+Compiler::ErrorCode RSCompilerDriver::prepareScript(RSScript &pScript,
+                                                    const char *pScriptName,
+                                                    const char *pRuntimePath,
+                                                    const char *pBuildChecksum) {
   // embed build checksum metadata into the source
   if (pBuildChecksum != nullptr && strlen(pBuildChecksum) > 0) {
     pScript.getSource().addBuildChecksumMetadata(pBuildChecksum);
@@ -128,12 +271,52 @@ Compiler::ErrorCode RSCompilerDriver::compileScript(RSScript& pScript, const cha
   //===--------------------------------------------------------------------===//
   // Link RS script with Renderscript runtime.
   //===--------------------------------------------------------------------===//
-  if (!RSScript::LinkRuntime(pScript, pRuntimePath)) {
-    ALOGE("Failed to link script '%s' with Renderscript runtime %s!",
-          pScriptName, pRuntimePath);
+  {
+    ScopedPhaseTimer timer(&mPhaseTimes, CompilePhaseTimes::kLink);
+    if (!RSScript::LinkRuntime(pScript, pRuntimePath)) {
+      ALOGE("Failed to link script '%s' with Renderscript runtime %s!",
+            pScriptName, pRuntimePath);
+      return Compiler::kErrInvalidSource;
+    }
+  }
+
+  // Setup the config to the compiler.
+  bool compiler_need_reconfigure = setupConfig(pScript);
+
+  if (mConfig == nullptr) {
+    ALOGE("Failed to setup config for RS compiler to compile %s!",
+          pScriptName);
     return Compiler::kErrInvalidSource;
   }
 
+  if (compiler_need_reconfigure) {
+    Compiler::ErrorCode err = mCompiler.config(*mConfig);
+    if (err != Compiler::kSuccess) {
+      ALOGE("Failed to config the RS compiler for %s! (%s)", pScriptName,
+            Compiler::GetErrorString(err));
+      return Compiler::kErrInvalidSource;
+    }
+  }
+
+  return Compiler::kSuccess;
+}
+
+Compiler::ErrorCode RSCompilerDriver::compileScript(RSScript& pScript, const char* pScriptName,
+                                                    const char* pOutputPath,
+                                                    const char* pRuntimePath,
+                                                    const char* pBuildChecksum,
+                                                    bool pDumpIR,
+                                                    const char *pCacheKey) {
+  Compiler::ErrorCode err = prepareScript(pScript, pScriptName, pRuntimePath,
+                                          pBuildChecksum);
+  if (err != Compiler::kSuccess) {
+    return err;
+  }
+
+  if (mAtomicPublish) {
+    return compileScriptAtomically(pScript, pOutputPath, pDumpIR, pCacheKey);
+  }
+
   {
     // FIXME(srhines): Windows compilation can't use locking like this, but
     // we also don't need to worry about concurrent writers of the same file.
@@ -160,24 +343,6 @@ Compiler::ErrorCode RSCompilerDriver::compileScript(RSScript& pScript, const cha
       return Compiler::kErrInvalidSource;
     }
 
-    // Setup the config to the compiler.
-    bool compiler_need_reconfigure = setupConfig(pScript);
-
-    if (mConfig == nullptr) {
-      ALOGE("Failed to setup config for RS compiler to compile %s!",
-            pOutputPath);
-      return Compiler::kErrInvalidSource;
-    }
-
-    if (compiler_need_reconfigure) {
-      Compiler::ErrorCode err = mCompiler.config(*mConfig);
-      if (err != Compiler::kSuccess) {
-        ALOGE("Failed to config the RS compiler for %s! (%s)",pOutputPath,
-              Compiler::GetErrorString(err));
-        return Compiler::kErrInvalidSource;
-      }
-    }
-
     OutputFile *ir_file = nullptr;
     llvm::raw_fd_ostream *IRStream = nullptr;
     if (pDumpIR) {
@@ -187,9 +352,19 @@ Compiler::ErrorCode RSCompilerDriver::compileScript(RSScript& pScript, const cha
       IRStream = ir_file->dup();
     }
 
-    // Run the compiler.
-    Compiler::ErrorCode compile_result =
-        mCompiler.compile(pScript, output_file, IRStream);
+    // Run the compiler. An object that also goes into the cache is compiled
+    // to memory first, so that the cache gets exactly the bytes written to
+    // pOutputPath under this lock and not whatever another writer of
+    // pOutputPath left there afterwards.
+    Compiler::ErrorCode compile_result;
+    llvm::SmallVector<char, 0> object;
+    if (pCacheKey != nullptr) {
+      llvm::raw_svector_ostream object_stream(object);
+      compile_result = mCompiler.compile(pScript, object_stream, IRStream);
+      object_stream.flush();
+    } else {
+      compile_result = mCompiler.compile(pScript, output_file, IRStream);
+    }
 
     if (ir_file) {
       ir_file->close();
@@ -201,11 +376,245 @@ Compiler::ErrorCode RSCompilerDriver::compileScript(RSScript& pScript, const cha
             Compiler::GetErrorString(compile_result));
       return Compiler::kErrInvalidSource;
     }
+
+    if (pCacheKey != nullptr) {
+      ScopedPhaseTimer write_timer(&mPhaseTimes, CompilePhaseTimes::kWrite);
+      if (output_file.write(object.data(), object.size()) !=
+          static_cast<ssize_t>(object.size())) {
+        ALOGE("Unable to write %s! (%s)", pOutputPath,
+              output_file.getErrorMessage().c_str());
+        return Compiler::kErrInvalidSource;
+      }
+      mObjectCache->insert(pCacheKey, object.data(), object.size());
+    }
+  }
+
+  return Compiler::kSuccess;
+}
+
+Compiler::ErrorCode
+RSCompilerDriver::compileScriptAtomically(RSScript &pScript,
+                                          const char *pOutputPath,
+                                          bool pDumpIR,
+                                          const char *pCacheKey) {
+  // Both outputs are written to temporaries next to them and only renamed
+  // into place once the compilation succeeded. Readers never need the lock.
+  AtomicOutputFile output_file(pOutputPath);
+  if (output_file.hasError()) {
+    ALOGE("Unable to open %s for write! (%s)", pOutputPath,
+          output_file.getErrorMessage().c_str());
+    return Compiler::kErrInvalidSource;
+  }
+
+  std::unique_ptr<AtomicOutputFile> ir_file;
+  llvm::raw_fd_ostream *IRStream = nullptr;
+  if (pDumpIR) {
+    std::string path(pOutputPath);
+    path.append(".ll");
+    ir_file.reset(new AtomicOutputFile(path));
+    if (ir_file->hasError()) {
+      ALOGE("Unable to open %s for write! (%s)", path.c_str(),
+            ir_file->getErrorMessage().c_str());
+      return Compiler::kErrInvalidSource;
+    }
+    IRStream = &ir_file->getStream();
+  }
+
+  // Run the compiler. An object that also goes into the cache is compiled to
+  // memory first, so that the cache gets exactly the bytes published here.
+  Compiler::ErrorCode compile_result;
+  llvm::SmallVector<char, 0> object;
+  if (pCacheKey != nullptr) {
+    llvm::raw_svector_ostream object_stream(object);
+    compile_result = mCompiler.compile(pScript, object_stream, IRStream);
+    object_stream.flush();
+    output_file.getStream().write(object.data(), object.size());
+  } else {
+    compile_result = mCompiler.compile(pScript, output_file.getStream(),
+                                       IRStream);
+  }
+
+  if (compile_result != Compiler::kSuccess) {
+    ALOGE("Unable to compile the source to file %s! (%s)", pOutputPath,
+          Compiler::GetErrorString(compile_result));
+    return Compiler::kErrInvalidSource;
+  }
+
+  if ((IRStream != nullptr) && !ir_file->commit()) {
+    ALOGE("Unable to publish %s.ll! (%s)", pOutputPath,
+          ir_file->getErrorMessage().c_str());
+    return Compiler::kErrInvalidSource;
+  }
+
+  ScopedPhaseTimer write_timer(&mPhaseTimes, CompilePhaseTimes::kWrite);
+  if (!output_file.commit()) {
+    ALOGE("Unable to publish %s! (%s)", pOutputPath,
+          output_file.getErrorMessage().c_str());
+    return Compiler::kErrInvalidSource;
+  }
+
+  if (pCacheKey != nullptr) {
+    mObjectCache->insert(pCacheKey, object.data(), object.size());
+  }
+
+  return Compiler::kSuccess;
+}
+
+Compiler::ErrorCode
+RSCompilerDriver::compileScriptToMemory(RSScript &pScript,
+                                        const char *pScriptName,
+                                        const char *pRuntimePath,
+                                        const char *pBuildChecksum,
+                                        llvm::SmallVectorImpl<char> &pObject,
+                                        std::string *pIR) {
+  Compiler::ErrorCode err = prepareScript(pScript, pScriptName, pRuntimePath,
+                                          pBuildChecksum);
+  if (err != Compiler::kSuccess) {
+    return err;
+  }
+
+  pObject.clear();
+  llvm::raw_svector_ostream object_stream(pObject);
+
+  std::unique_ptr<llvm::raw_string_ostream> ir_stream;
+  if (pIR != nullptr) {
+    pIR->clear();
+    ir_stream.reset(new llvm::raw_string_ostream(*pIR));
+  }
+
+  // Run the compiler.
+  Compiler::ErrorCode compile_result =
+      mCompiler.compile(pScript, object_stream, ir_stream.get());
+
+  object_stream.flush();
+  if (ir_stream) {
+    ir_stream->flush();
+  }
+
+  if (compile_result != Compiler::kSuccess) {
+    ALOGE("Unable to compile the source %s! (%s)", pScriptName,
+          Compiler::GetErrorString(compile_result));
+    return Compiler::kErrInvalidSource;
   }
 
   return Compiler::kSuccess;
 }
 
+void RSCompilerDriver::setupScript(RSScript &pScript, const char *pBitcode,
+                                   size_t pBitcodeSize,
+                                   RSLinkRuntimeCallback pLinkRuntimeCallback) {
+  if (pLinkRuntimeCallback) {
+    setLinkRuntimeCallback(pLinkRuntimeCallback);
+  }
+
+  pScript.setLinkRuntimeCallback(getLinkRuntimeCallback());
+
+  pScript.setEmbedGlobalInfo(mEmbedGlobalInfo);
+  pScript.setEmbedGlobalInfoSkipConstant(mEmbedGlobalInfoSkipConstant);
+  pScript.setSelectiveRuntimeImport(mSelectiveRuntimeImport);
+
+  pScript.setProfileInstrument(mProfileInstrument);
+  if (!mProfileInstrument && !mProfilePath.empty()) {
+    // Without its profile the script is still compiled, just as usual.
+    if (mProfile.read(mProfilePath)) {
+      pScript.setProfile(&mProfile);
+    }
+  }
+
+  // Read information from bitcode wrapper.
+  bcinfo::BitcodeWrapper wrapper(pBitcode, pBitcodeSize);
+  pScript.setCompilerVersion(wrapper.getCompilerVersion());
+  pScript.setOptimizationLevel(static_cast<RSScript::OptimizationLevel>(
+                               wrapper.getOptimizationLevel()));
+  pScript.setInlineThreshold(mInlineThreshold);
+  pScript.setRegAlloc(CompilerConfig::kRegAllocDefault);
+
+  if (mCompileBudget != 0) {
+    fitCompileBudget(pScript, pBitcodeSize);
+  }
+}
+
+namespace {
+
+// The estimated cost of compiling a script with a set of optimizations:
+// mBase + mPerKB * (bitcode KB) + mPerKernel * (kernels) +
+// mPerRuntimeRef * (runtime functions referenced).
+//
+// The cost is relative and has no unit. The coefficients were not measured
+// on any device; they only order the tiers by cost and make it grow with the
+// size of the script.
+struct CompileTier {
+  RSScript::OptimizationLevel mOptLevel;
+  int mInlineThreshold;
+  CompilerConfig::RegAllocKind mRegAlloc;
+  double mBase;
+  double mPerKB;
+  double mPerKernel;
+  double mPerRuntimeRef;
+};
+
+// From the most to the least expensive.
+const CompileTier kCompileTiers[] = {
+  { RSScript::kOptLvl3, -1,  CompilerConfig::kRegAllocGreedy,
+    40, 6.0, 15, 0.5 },
+  { RSScript::kOptLvl2, 100, CompilerConfig::kRegAllocGreedy,
+    35, 4.5, 10, 0.4 },
+  { RSScript::kOptLvl1, 25,  CompilerConfig::kRegAllocBasic,
+    25, 2.5,  5, 0.3 },
+  { RSScript::kOptLvl0, -1,  CompilerConfig::kRegAllocFast,
+    15, 1.0,  2, 0.2 },
+};
+
+} // end anonymous namespace
+
+void RSCompilerDriver::fitCompileBudget(RSScript &pScript,
+                                        size_t pBitcodeSize) const {
+  const llvm::Module &module = pScript.getSource().getModule();
+
+  // The module is loaded lazily; the functions still to be materialized are
+  // not declarations, so this counts exactly the external references.
+  unsigned num_runtime_refs = 0;
+  for (const llvm::Function &f : module) {
+    if (f.isDeclaration() && !f.isIntrinsic()) {
+      num_runtime_refs++;
+    }
+  }
+
+  const bcinfo::MetadataExtractor *me = pScript.getSource().getMetadata();
+  const unsigned num_kernels =
+      (me != nullptr) ? me->getExportForEachSignatureCount() : 0;
+
+  const double size_kb = pBitcodeSize / 1024.0;
+  const RSScript::OptimizationLevel wrapper_level =
+      pScript.getOptimizationLevel();
+
+  const size_t num_tiers = sizeof(kCompileTiers) / sizeof(kCompileTiers[0]);
+  for (size_t i = 0; i < num_tiers; i++) {
+    const CompileTier &tier = kCompileTiers[i];
+    // Never optimize more than the script asked for.
+    if (tier.mOptLevel > wrapper_level) {
+      continue;
+    }
+
+    const double cost = tier.mBase + tier.mPerKB * size_kb +
+        tier.mPerKernel * num_kernels + tier.mPerRuntimeRef * num_runtime_refs;
+
+    // The cheapest tier is used even if it does not fit.
+    if ((cost <= mCompileBudget) || (i == num_tiers - 1)) {
+      if (tier.mOptLevel != wrapper_level) {
+        ALOGV("Compiling %s at -O%d instead of -O%d to fit budget %u "
+              "(est. cost %.0f)",
+              pScript.getSource().getName().c_str(), tier.mOptLevel,
+              wrapper_level, mCompileBudget, cost);
+      }
+      pScript.setOptimizationLevel(tier.mOptLevel);
+      pScript.setInlineThreshold(tier.mInlineThreshold);
+      pScript.setRegAlloc(tier.mRegAlloc);
+      return;
+    }
+  }
+}
+
 bool RSCompilerDriver::build(BCCContext &pContext,
                              const char *pCacheDir,
                              const char *pResName,
@@ -215,7 +624,25 @@ bool RSCompilerDriver::build(BCCContext &pContext,
                              const char *pRuntimePath,
                              RSLinkRuntimeCallback pLinkRuntimeCallback,
                              bool pDumpIR) {
-    //  android::StopWatch build_time("bcc: RSCompilerDriver::build time");
+  return buildObject(pContext, pCacheDir, pResName, pBitcode, pBitcodeSize,
+                     pBuildChecksum, pRuntimePath, pLinkRuntimeCallback,
+                     pDumpIR, /* pQuickTier */false, /* pEmbedInfo */false);
+}
+
+bool RSCompilerDriver::buildObject(BCCContext &pContext,
+                                   const char *pCacheDir,
+                                   const char *pResName,
+                                   const char *pBitcode,
+                                   size_t pBitcodeSize,
+                                   const char *pBuildChecksum,
+                                   const char *pRuntimePath,
+                                   RSLinkRuntimeCallback pLinkRuntimeCallback,
+                                   bool pDumpIR,
+                                   bool pQuickTier,
+                                   bool pEmbedInfo) {
+  mPhaseTimes.reset();
+  mPassReport.reset();
+
   //===--------------------------------------------------------------------===//
   // Check parameters.
   //===--------------------------------------------------------------------===//
@@ -243,27 +670,64 @@ bool RSCompilerDriver::build(BCCContext &pContext,
   //===--------------------------------------------------------------------===//
   // Load the bitcode and create script.
   //===--------------------------------------------------------------------===//
+  ScopedPhaseTimer load_timer(&mPhaseTimes, CompilePhaseTimes::kLoad);
   Source *source = Source::CreateFromBuffer(pContext, pResName,
                                             pBitcode, pBitcodeSize);
+  load_timer.stop();
   if (source == nullptr) {
     return false;
   }
 
+  // The source is only needed for this build; release it when done instead
+  // of keeping it alive in pContext.
+  std::unique_ptr<Source> source_owner(source);
+
   RSScript script(*source);
-  if (pLinkRuntimeCallback) {
-    setLinkRuntimeCallback(pLinkRuntimeCallback);
+  setupScript(script, pBitcode, pBitcodeSize, pLinkRuntimeCallback);
+  if (pQuickTier) {
+    // -O0 also makes Compiler use the fast register allocator.
+    script.setOptimizationLevel(RSScript::kOptLvl0);
+    script.setInlineThreshold(-1);
+    script.setRegAlloc(CompilerConfig::kRegAllocDefault);
+  }
+  if (pEmbedInfo) {
+    script.setEmbedInfo(true);
   }
 
-  script.setLinkRuntimeCallback(getLinkRuntimeCallback());
+  //===--------------------------------------------------------------------===//
+  // Look up the object cache
+  //===--------------------------------------------------------------------===//
+  // A link-runtime callback can rewrite the module in ways the key cannot
+  // capture, so scripts built with one always go through the compiler. The
+  // key does not cover the embedded info either.
+  std::string cache_key;
+  if ((mObjectCache != nullptr) && (getLinkRuntimeCallback() == nullptr) &&
+      !pEmbedInfo) {
+    // The key covers the compiler configuration, so settle it first.
+    // compileScript() will then find nothing left to change.
+    if (setupConfig(script)) {
+      Compiler::ErrorCode err = mCompiler.config(*mConfig);
+      if (err != Compiler::kSuccess) {
+        ALOGE("Failed to config the RS compiler for %s! (%s)",
+              output_path.c_str(), Compiler::GetErrorString(err));
+        return false;
+      }
+    }
 
-  script.setEmbedGlobalInfo(mEmbedGlobalInfo);
-  script.setEmbedGlobalInfoSkipConstant(mEmbedGlobalInfoSkipConstant);
+    if (!computeObjectCacheKey(pBitcode, pBitcodeSize, pBuildChecksum,
+                               pRuntimePath, cache_key)) {
+      cache_key.clear();
+    }
 
-  // Read information from bitcode wrapper.
-  bcinfo::BitcodeWrapper wrapper(pBitcode, pBitcodeSize);
-  script.setCompilerVersion(wrapper.getCompilerVersion());
-  script.setOptimizationLevel(static_cast<RSScript::OptimizationLevel>(
-                              wrapper.getOptimizationLevel()));
+    // A cached object comes without its IR, so honor pDumpIR by compiling.
+    if (!cache_key.empty() && !pDumpIR) {
+      ScopedPhaseTimer timer(&mPhaseTimes, CompilePhaseTimes::kWrite);
+      if (mObjectCache->retrieve(cache_key, output_path.c_str(),
+                                 mAtomicPublish)) {
+        return true;
+      }
+    }
+  }
 
   //===--------------------------------------------------------------------===//
   // Compile the script
@@ -272,11 +736,431 @@ bool RSCompilerDriver::build(BCCContext &pContext,
                                              output_path.c_str(),
                                              pRuntimePath,
                                              pBuildChecksum,
-                                             pDumpIR);
+                                             pDumpIR,
+                                             cache_key.empty() ?
+                                                 nullptr : cache_key.c_str());
 
   return status == Compiler::kSuccess;
 }
 
+bool RSCompilerDriver::build(BCCContext &pContext,
+                             const char *pResName,
+                             const char *pBitcode,
+                             size_t pBitcodeSize,
+                             const char *pBuildChecksum,
+                             const char *pRuntimePath,
+                             llvm::SmallVectorImpl<char> &pObject,
+                             std::string *pIR) {
+  mPhaseTimes.reset();
+  mPassReport.reset();
+
+  //===--------------------------------------------------------------------===//
+  // Check parameters.
+  //===--------------------------------------------------------------------===//
+  if (pResName == nullptr) {
+    ALOGE("Invalid parameter passed to RSCompilerDriver::build()! (resource "
+          "name: (null))");
+    return false;
+  }
+
+  if ((pBitcode == nullptr) || (pBitcodeSize <= 0)) {
+    ALOGE("No bitcode supplied! (bitcode: %p, size of bitcode: %u)",
+          pBitcode, static_cast<unsigned>(pBitcodeSize));
+    return false;
+  }
+
+  //===--------------------------------------------------------------------===//
+  // Load the bitcode and create script.
+  //===--------------------------------------------------------------------===//
+  ScopedPhaseTimer load_timer(&mPhaseTimes, CompilePhaseTimes::kLoad);
+  std::unique_ptr<Source> source(Source::CreateFromBuffer(pContext, pResName,
+                                                          pBitcode,
+                                                          pBitcodeSize));
+  load_timer.stop();
+  if (source == nullptr) {
+    return false;
+  }
+
+  RSScript script(*source);
+  setupScript(script, pBitcode, pBitcodeSize, nullptr);
+
+  //===--------------------------------------------------------------------===//
+  // Compile the script
+  //===--------------------------------------------------------------------===//
+  Compiler::ErrorCode status = compileScriptToMemory(script, pResName,
+                                                     pRuntimePath,
+                                                     pBuildChecksum,
+                                                     pObject, pIR);
+
+  return status == Compiler::kSuccess;
+}
+
+bool RSCompilerDriver::inheritSettings(const RSCompilerDriver &pOther) {
+  if (pOther.mConfig != nullptr) {
+    delete mConfig;
+    mConfig = new (std::nothrow) CompilerConfig(*pOther.mConfig);
+    if (mConfig == nullptr) {
+      return false;
+    }
+
+    Compiler::ErrorCode err = mCompiler.config(*mConfig);
+    if (err != Compiler::kSuccess) {
+      ALOGE("Failed to config the RS compiler! (%s)",
+            Compiler::GetErrorString(err));
+      return false;
+    }
+  }
+
+  mDebugContext = pOther.mDebugContext;
+  mLinkRuntimeCallback = pOther.mLinkRuntimeCallback;
+  mEnableGlobalMerge = pOther.mEnableGlobalMerge;
+  mEmbedGlobalInfo = pOther.mEmbedGlobalInfo;
+  mEmbedGlobalInfoSkipConstant = pOther.mEmbedGlobalInfoSkipConstant;
+  mSelectiveRuntimeImport = pOther.mSelectiveRuntimeImport;
+  mAtomicPublish = pOther.mAtomicPublish;
+  setInstrumentPasses(pOther.mInstrumentPasses);
+  mVectorizeMode = pOther.mVectorizeMode;
+  mUseRSPipeline = pOther.mUseRSPipeline;
+  mInlineThreshold = pOther.mInlineThreshold;
+  mMultiVersionKernels = pOther.mMultiVersionKernels;
+  mExpandTiles = pOther.mExpandTiles;
+  mProfileInstrument = pOther.mProfileInstrument;
+  mProfilePath = pOther.mProfilePath;
+  mCompileBudget = pOther.mCompileBudget;
+  mOptimizedTierProcess = pOther.mOptimizedTierProcess;
+  setObjectCacheDir((pOther.mObjectCache != nullptr) ?
+                    pOther.mObjectCache->getCacheDir().c_str() : nullptr);
+
+  return true;
+}
+
+bool RSCompilerDriver::buildBatch(const char *pCacheDir,
+                                  const std::vector<RSBuildJob> &pJobs,
+                                  const char *pRuntimePath,
+                                  std::vector<bool> &pResults,
+                                  unsigned pNumThreads) {
+  pResults.assign(pJobs.size(), false);
+
+  // Two jobs with the same name would write (and lock) the same object file.
+  std::set<std::string> res_names;
+  for (const RSBuildJob &job : pJobs) {
+    if ((job.mResName == nullptr) || !res_names.insert(job.mResName).second) {
+      ALOGE("Invalid or duplicate resource name passed to "
+            "RSCompilerDriver::buildBatch()! (%s)",
+            (job.mResName != nullptr) ? job.mResName : "(null)");
+      return false;
+    }
+  }
+
+  if (pJobs.empty()) {
+    return true;
+  }
+
+  // Settle all the process-wide state that the workers would otherwise set
+  // up concurrently: creating a CompilerConfig resets the default scheduler
+  // and setupConfig() writes the global merge option.
+  if (mConfig == nullptr) {
+    mConfig = new (std::nothrow) CompilerConfig(DEFAULT_TARGET_TRIPLE_STRING);
+    if (mConfig == nullptr) {
+      return false;
+    }
+  }
+#if defined(PROVIDE_ARM_CODEGEN)
+  EnableGlobalMerge = mEnableGlobalMerge;
+#endif
+
+  if (pNumThreads == 0) {
+    pNumThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  pNumThreads = std::min<size_t>(pNumThreads, pJobs.size());
+
+  // std::vector<bool> packs bits, so workers cannot safely write to distinct
+  // elements of pResults. Collect the results here instead.
+  std::unique_ptr<std::atomic<bool>[]> results(
+      new std::atomic<bool>[pJobs.size()]);
+  std::atomic<size_t> next_job(0);
+
+  auto worker = [&]() {
+    RSCompilerDriver driver;
+    bool configured = driver.inheritSettings(*this);
+    BCCContext context;
+
+    for (size_t i = next_job++; i < pJobs.size(); i = next_job++) {
+      const RSBuildJob &job = pJobs[i];
+      results[i] = configured &&
+                   driver.build(context, pCacheDir, job.mResName,
+                                job.mBitcode, job.mBitcodeSize,
+                                job.mBuildChecksum, pRuntimePath);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < pNumThreads; i++) {
+    workers.emplace_back(worker);
+  }
+  // The calling thread is one of the workers.
+  worker();
+  for (std::thread &t : workers) {
+    t.join();
+  }
+
+  bool all_succeeded = true;
+  for (size_t i = 0; i < pJobs.size(); i++) {
+    pResults[i] = results[i];
+    all_succeeded = all_succeeded && results[i];
+  }
+
+  return all_succeeded;
+}
+
+//===----------------------------------------------------------------------===//
+// Tiered compilation
+//===----------------------------------------------------------------------===//
+// The -O3 compilation of one script started by buildTiered(). It runs with
+// its own driver, context and copies of the inputs, so neither the caller's
+// buffers and BCCContext nor the driver that started it need to stay around.
+struct RSCompilerDriver::OptimizedTier {
+  std::string mOutputPath;
+
+  std::unique_ptr<RSCompilerDriver> mDriver;
+  std::string mCacheDir;
+  std::string mResName;
+  std::vector<char> mBitcode;
+  std::string mBuildChecksum;
+  bool mHasBuildChecksum;
+  std::string mRuntimePath;
+  bool mEmbedRSInfo;
+
+  // The child process compiling the tier, or -1 if it runs on a thread.
+  pid_t mPid;
+
+  // The thread compiling the tier, if it runs on one.
+  std::thread mThread;
+
+  std::mutex mLock;
+  std::condition_variable mFinished;
+  bool mReady;
+  bool mSucceeded;
+
+  OptimizedTier() : mHasBuildChecksum(false), mEmbedRSInfo(false), mPid(-1),
+                    mReady(false), mSucceeded(false) { }
+
+  bool build() {
+    BCCContext context;
+    return mDriver->buildObject(context, mCacheDir.c_str(), mResName.c_str(),
+                                mBitcode.data(), mBitcode.size(),
+                                mHasBuildChecksum ? mBuildChecksum.c_str()
+                                                  : nullptr,
+                                mRuntimePath.c_str(), nullptr,
+                                /* pDumpIR */false, /* pQuickTier */false,
+                                mEmbedRSInfo);
+  }
+
+  void finish(bool pSucceeded) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mSucceeded = pSucceeded;
+    mReady = true;
+    mFinished.notify_all();
+  }
+
+  // Return whether the tier has finished, blocking until it has if pBlock is
+  // true.
+  bool poll(bool pBlock) {
+#ifndef USE_MINGW
+    if (mPid > 0) {
+      int status;
+      pid_t ret = ::waitpid(mPid, &status, pBlock ? 0 : WNOHANG);
+      if (ret == mPid) {
+        mPid = -1;
+        finish(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+      } else if (ret < 0) {
+        ALOGE("Lost track of the optimized tier of %s! (%s)",
+              mOutputPath.c_str(), ::strerror(errno));
+        mPid = -1;
+        finish(false);
+      }
+    }
+#endif
+
+    std::unique_lock<std::mutex> lock(mLock);
+    if (pBlock) {
+      mFinished.wait(lock, [this] { return mReady; });
+    }
+    return mReady;
+  }
+
+  // Wait for the thread compiling the tier, if any, to exit.
+  void join() {
+    if (mThread.joinable()) {
+      mThread.join();
+    }
+  }
+};
+
+RSCompilerDriver::~RSCompilerDriver() {
+  // Threads of optimized tiers must not outlive the process's static state
+  // (LLVM's included), so wait for them. Child processes carry on by
+  // themselves; only reap those that are done already.
+  for (const std::shared_ptr<OptimizedTier> &tier : mOptimizedTiers) {
+    if (tier->mPid > 0) {
+      tier->poll(/* pBlock */false);
+    }
+    tier->join();
+  }
+
+  delete mConfig;
+  delete mObjectCache;
+}
+
+bool RSCompilerDriver::buildTiered(BCCContext &pContext,
+                                   const char *pCacheDir,
+                                   const char *pResName,
+                                   const char *pBitcode,
+                                   size_t pBitcodeSize,
+                                   const char *pBuildChecksum,
+                                   const char *pRuntimePath,
+                                   bool pEmbedRSInfo) {
+  if ((pCacheDir == nullptr) || (pResName == nullptr) ||
+      (pRuntimePath == nullptr)) {
+    ALOGE("Invalid parameter passed to RSCompilerDriver::buildTiered()!");
+    return false;
+  }
+
+  if ((pBitcode == nullptr) || (pBitcodeSize <= 0)) {
+    ALOGE("No bitcode supplied! (bitcode: %p, size of bitcode: %u)",
+          pBitcode, static_cast<unsigned>(pBitcodeSize));
+    return false;
+  }
+
+  llvm::SmallString<80> output_path(pCacheDir);
+  llvm::sys::path::append(output_path, pResName);
+  llvm::sys::path::replace_extension(output_path, ".o");
+
+  // Forget the tiers that have finished, so that a long-lived driver does not
+  // accumulate them. An optimized tier still running for the same output
+  // would later replace the object built here with one from the old bitcode,
+  // so wait for it.
+  for (auto I = mOptimizedTiers.begin(); I != mOptimizedTiers.end(); ) {
+    if ((*I)->poll((*I)->mOutputPath == output_path.str())) {
+      (*I)->join();
+      I = mOptimizedTiers.erase(I);
+    } else {
+      ++I;
+    }
+  }
+
+  std::shared_ptr<OptimizedTier> tier(new (std::nothrow) OptimizedTier());
+  if (tier == nullptr) {
+    return false;
+  }
+  tier->mOutputPath = output_path.str();
+  mOptimizedTiers.push_back(tier);
+
+  // Scripts that ask for -O0 have nothing to gain from a second tier.
+  bcinfo::BitcodeWrapper wrapper(pBitcode, pBitcodeSize);
+  if (wrapper.getOptimizationLevel() == RSScript::kOptLvl0) {
+    bool built = buildObject(pContext, pCacheDir, pResName, pBitcode,
+                             pBitcodeSize, pBuildChecksum, pRuntimePath,
+                             nullptr, /* pDumpIR */false,
+                             /* pQuickTier */false, pEmbedRSInfo);
+    tier->finish(built);
+    return built;
+  }
+
+  if (!buildObject(pContext, pCacheDir, pResName, pBitcode, pBitcodeSize,
+                   pBuildChecksum, pRuntimePath, nullptr,
+                   /* pDumpIR */false, /* pQuickTier */true, pEmbedRSInfo)) {
+    tier->finish(false);
+    return false;
+  }
+
+  // Configure the worker here, while this driver's settings are known not to
+  // be changing underneath it. Without it the quick object stays in place.
+  tier->mDriver.reset(new (std::nothrow) RSCompilerDriver());
+  if ((tier->mDriver == nullptr) || !tier->mDriver->inheritSettings(*this)) {
+    ALOGE("Unable to set up the optimized tier of %s!", pResName);
+    tier->finish(false);
+    return true;
+  }
+  // Readers may have the quick object open already; never rewrite it in
+  // place.
+  tier->mDriver->setAtomicPublish(true);
+
+  tier->mCacheDir = pCacheDir;
+  tier->mResName = pResName;
+  tier->mBitcode.assign(pBitcode, pBitcode + pBitcodeSize);
+  tier->mHasBuildChecksum = (pBuildChecksum != nullptr);
+  if (pBuildChecksum != nullptr) {
+    tier->mBuildChecksum = pBuildChecksum;
+  }
+  tier->mRuntimePath = pRuntimePath;
+  tier->mEmbedRSInfo = pEmbedRSInfo;
+
+#ifndef USE_MINGW
+  if (mOptimizedTierProcess) {
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      // Whoever ran the caller may be waiting for its output streams to
+      // close; do not hold them open.
+      int null_fd = ::open("/dev/null", O_RDWR);
+      if (null_fd >= 0) {
+        ::dup2(null_fd, STDIN_FILENO);
+        ::dup2(null_fd, STDOUT_FILENO);
+        ::dup2(null_fd, STDERR_FILENO);
+        ::close(null_fd);
+      }
+      ::_exit(tier->build() ? 0 : 1);
+    }
+
+    if (pid > 0) {
+      tier->mPid = pid;
+      return true;
+    }
+
+    ALOGE("Unable to fork the optimized tier of %s! (%s)", pResName,
+          ::strerror(errno));
+    tier->finish(false);
+    return true;
+  }
+#endif
+
+  // The driver joins the thread before it lets go of the tier.
+  OptimizedTier *worker = tier.get();
+  worker->mThread = std::thread([worker] { worker->finish(worker->build()); });
+
+  return true;
+}
+
+bool RSCompilerDriver::isOptimizedTierReady(const char *pCacheDir,
+                                            const char *pResName) {
+  llvm::SmallString<80> output_path(pCacheDir);
+  llvm::sys::path::append(output_path, pResName);
+  llvm::sys::path::replace_extension(output_path, ".o");
+
+  for (const std::shared_ptr<OptimizedTier> &tier : mOptimizedTiers) {
+    if (tier->mOutputPath == output_path.str()) {
+      if (!tier->poll(/* pBlock */false)) {
+        return false;
+      }
+      std::lock_guard<std::mutex> lock(tier->mLock);
+      return tier->mSucceeded;
+    }
+  }
+
+  return false;
+}
+
+bool RSCompilerDriver::waitForOptimizedTiers() {
+  bool all_succeeded = true;
+  for (const std::shared_ptr<OptimizedTier> &tier : mOptimizedTiers) {
+    tier->poll(/* pBlock */true);
+    std::lock_guard<std::mutex> lock(tier->mLock);
+    all_succeeded = all_succeeded && tier->mSucceeded;
+  }
+
+  return all_succeeded;
+}
+
 bool RSCompilerDriver::buildScriptGroup(
     BCCContext& Context, const char* pOutputFilepath, const char* pRuntimePath,
     const char* pRuntimeRelaxedPath, bool dumpIR, const char* buildChecksum,
@@ -285,6 +1169,9 @@ bool RSCompilerDriver::buildScriptGroup(
     const std::list<std::string>& fused,
     const std::list<std::list<std::pair<int, int>>>& invokes,
     const std::list<std::string>& invokeBatchNames) {
+  mPhaseTimes.reset();
+  mPassReport.reset();
+
   // ---------------------------------------------------------------------------
   // Link all input modules into a single module
   // ---------------------------------------------------------------------------
@@ -340,6 +1227,9 @@ bool RSCompilerDriver::buildScriptGroup(
   // Compile the new module with fused kernels
   // ---------------------------------------------------------------------------
 
+  // The source is only created now that fusion and renaming have added to the
+  // export metadata, so its cached metadata includes them.
+
   const std::unique_ptr<Source> source(
       Source::CreateFromModule(Context, pOutputFilepath, module, true));
   RSScript script(*source);
@@ -349,6 +1239,7 @@ bool RSCompilerDriver::buildScriptGroup(
   script.setOptimizationLevel(RSScript::kOptLvl3);
   script.setEmbedGlobalInfo(mEmbedGlobalInfo);
   script.setEmbedGlobalInfoSkipConstant(mEmbedGlobalInfoSkipConstant);
+  script.setSelectiveRuntimeImport(mSelectiveRuntimeImport);
 
   llvm::SmallString<80> output_path(pOutputFilepath);
   llvm::sys::path::replace_extension(output_path, ".o");
@@ -356,9 +1247,9 @@ bool RSCompilerDriver::buildScriptGroup(
   // Pick the right runtime lib
   const char* coreLibPath = pRuntimePath;
   if (strcmp(pRuntimeRelaxedPath, "")) {
-      bcinfo::MetadataExtractor me(&module);
-      me.extract();
-      if (me.getRSFloatPrecision() == bcinfo::RS_FP_Relaxed) {
+      const bcinfo::MetadataExtractor *me = source->getMetadata();
+      if ((me != nullptr) &&
+          (me->getRSFloatPrecision() == bcinfo::RS_FP_Relaxed)) {
           coreLibPath = pRuntimeRelaxedPath;
       }
   }
@@ -373,12 +1264,16 @@ bool RSCompilerDriver::buildForCompatLib(RSScript &pScript, const char *pOut,
                                          const char *pBuildChecksum,
                                          const char *pRuntimePath,
                                          bool pDumpIR) {
+  mPhaseTimes.reset();
+  mPassReport.reset();
+
   // Embed the info string directly in the ELF, since this path is for an
   // offline (host) compilation.
   pScript.setEmbedInfo(true);
 
   pScript.setEmbedGlobalInfo(mEmbedGlobalInfo);
   pScript.setEmbedGlobalInfoSkipConstant(mEmbedGlobalInfoSkipConstant);
+  pScript.setSelectiveRuntimeImport(mSelectiveRuntimeImport);
   pScript.setLinkRuntimeCallback(getLinkRuntimeCallback());
 
   Compiler::ErrorCode status = compileScript(pScript, pOut, pOut, pRuntimePath,
@@ -16,12 +16,14 @@
 
 #include "bcc/Assert.h"
 #include "bcc/Config/Config.h"
+#include "bcc/Renderscript/RSExpandReduce.h"
 #include "bcc/Renderscript/RSTransforms.h"
 #include "bcc/Support/Log.h"
 #include "bcinfo/MetadataExtractor.h"
 #include "rsDefines.h"
 
 #include <cstdlib>
+#include <string>
 #include <vector>
 
 #include <llvm/IR/DerivedTypes.h>
@@ -64,6 +66,8 @@ public:
   static std::string getRSInfoString(const llvm::Module *module) {
     std::string str;
     llvm::raw_string_ostream s(str);
+    // Not Source::getMetadata(): #rs_is_threadable is only added by a pass
+    // that runs after the metadata was cached.
     bcinfo::MetadataExtractor me(module);
     if (!me.extract()) {
       bccAssert(false && "Could not extract RS metadata for module!");
@@ -127,6 +131,40 @@ public:
       s << "buildChecksum: " << buildChecksum << "\n";
     }
 
+    // Reduction kernels come last, and only if there are any, so that the
+    // info of scripts without them does not change. Each line has
+    // the accumulator signature, the accumulator data size and the names of
+    // the reduction and of its initializer, accumulator, combiner and
+    // outconverter functions, with "." for missing functions. The combiner
+    // is the generated one (see RSExpandReduce.h) if the script gives none.
+    size_t exportReduceCount = me.getExportReduceCount();
+    const bcinfo::MetadataExtractor::Reduce *exportReduceList =
+        me.getExportReduceList();
+    if (exportReduceCount > 0) {
+      s << "exportReduceCount: " << exportReduceCount << "\n";
+    }
+    for (i = 0; i < exportReduceCount; ++i) {
+      const bcinfo::MetadataExtractor::Reduce &reduce = exportReduceList[i];
+      std::string combiner;
+      if (reduce.mCombinerName) {
+        combiner = reduce.mCombinerName;
+      } else {
+        combiner = std::string(reduce.mAccumulatorName) +
+                   kRsReduceCombinerSuffix;
+        if (module->getFunction(combiner) == nullptr) {
+          combiner = ".";
+        }
+      }
+      s << reduce.mSignature << " - "
+        << reduce.mAccumulatorDataSize << " - "
+        << reduce.mReduceName << " - "
+        << (reduce.mInitializerName ? reduce.mInitializerName : ".") << " - "
+        << reduce.mAccumulatorName << " - "
+        << combiner << " - "
+        << (reduce.mOutConverterName ? reduce.mOutConverterName : ".")
+        << "\n";
+    }
+
     s.flush();
     return str;
   }
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSTransforms.h"
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Pass.h>
+
+namespace {
+
+/*
+ * RSFastMathPass - This pass attaches the fast-math flags that the
+ * rs_fp_relaxed precision allows to every floating point division of a
+ * script, including those of the .expand functions and of the runtime
+ * library linked into it (the library functions of a relaxed script are
+ * held to the relaxed precision, too).
+ *
+ * rs_fp_relaxed allows flushing denormals to zero, rounding towards zero and
+ * a lower precision of math functions, but it requires NaNs, infinities and
+ * signed zeros to be honored. Of the flags LLVM 3.7 has, this leaves "arcp"
+ * (x / y may become x * (1 / y)), which only means something on fdiv;
+ * reassociation is only available as part of "fast", which also assumes
+ * there are no NaNs or infinities.
+ * Contraction into fused multiply-adds is controlled by
+ * TargetOptions::AllowFPOpFusion instead (see CompilerConfig).
+ *
+ * This pass should run after foreachexp, so that it sees the .expand
+ * functions, and before inlining and instcombine, which make use of the
+ * flags.
+ */
+class RSFastMathPass : public llvm::FunctionPass {
+public:
+  static char ID;
+
+  RSFastMathPass() : FunctionPass(ID) { }
+
+  virtual bool runOnFunction(llvm::Function &F) {
+    bool Changed = false;
+
+    for (llvm::inst_iterator I = llvm::inst_begin(F), E = llvm::inst_end(F);
+         I != E; ++I) {
+      llvm::BinaryOperator *BO = llvm::dyn_cast<llvm::BinaryOperator>(&*I);
+      if ((BO != nullptr) && (BO->getOpcode() == llvm::Instruction::FDiv) &&
+          !BO->hasAllowReciprocal()) {
+        BO->setHasAllowReciprocal(true);
+        Changed = true;
+      }
+    }
+
+    return Changed;
+  }
+
+  virtual const char *getPassName() const {
+    return "Renderscript Relaxed Fast-Math Flags";
+  }
+}; // end RSFastMathPass
+
+} // end anonymous namespace
+
+char RSFastMathPass::ID = 0;
+
+namespace bcc {
+
+llvm::FunctionPass *
+createRSFastMathPass() {
+  return new RSFastMathPass();
+}
+
+} // end namespace bcc
@@ -15,10 +15,14 @@
  */
 
 #include "bcc/Assert.h"
+#include "bcc/Renderscript/RSExpandReduce.h"
+#include "bcc/Renderscript/RSExpandTile.h"
 #include "bcc/Renderscript/RSTransforms.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <functional>
+#include <memory>
 
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
@@ -42,6 +46,9 @@
 
 using namespace bcc;
 
+const char bcc::kRsExpandTileVersion[] = ".rs.expand_tile_version";
+const char bcc::kRsReduceCombinerSuffix[] = ".combiner";
+
 namespace {
 
 static const bool gEnableRsTbaa = true;
@@ -87,6 +94,21 @@ private:
     RsExpandKernelDriverInfoPfxFieldCount
   };
 
+  enum RsExpandTileField {
+    RsExpandTileFieldX1,
+    RsExpandTileFieldX2,
+    RsExpandTileFieldY1,
+    RsExpandTileFieldY2,
+    RsExpandTileFieldZ1,
+    RsExpandTileFieldZ2,
+    RsExpandTileFieldOutRowStride,
+    RsExpandTileFieldOutSliceStride,
+    RsExpandTileFieldInRowStride,
+    RsExpandTileFieldInSliceStride,
+
+    RsExpandTileFieldCount
+  };
+
   llvm::Module *Module;
   llvm::LLVMContext *Context;
 
@@ -97,13 +119,31 @@ private:
    */
   llvm::FunctionType *ExpandedFunctionType;
 
+  // The same for the tiled variants of expanded kernels.
+  llvm::FunctionType *ExpandedTileFunctionType;
+
+  // The same for the expanded accumulators of reduction kernels.
+  llvm::FunctionType *ExpandedAccumulatorType;
+
   uint32_t mExportForEachCount;
   const char **mExportForEachNameList;
   const uint32_t *mExportForEachSignatureList;
 
+  size_t mExportReduceCount;
+  const bcinfo::MetadataExtractor::Reduce *mExportReduceList;
+
   // Turns on optimization of allocation stride values.
   bool mEnableStepOpt;
 
+  // Turns on the widened loops of ExpandKernel() (see getKernelLoopWidth()).
+  bool mWidenKernelLoops;
+
+  // Turns on the tiled variants of expanded kernels (see RSExpandTile.h).
+  bool mExpandTiles;
+
+  // If not null, the already extracted metadata of the module to run on.
+  const bcinfo::MetadataExtractor *mMetadata;
+
   uint32_t getRootSignature(llvm::Function *Function) {
     const llvm::NamedMDNode *ExportForEachMetadata =
         Module->getNamedMetadata("#rs_export_foreach");
@@ -211,6 +251,33 @@ private:
     }
   }
 
+  // Get the constant step through an allocation whose cells are contiguous,
+  // for use in place of a Step that getStepValue() could not make constant.
+  //
+  // Returns the alloc size of the element type of AllocType, or Step itself
+  // if Step is already constant or there is no such size.
+  llvm::Value *getContiguousStepValue(const llvm::DataLayout &DL,
+                                      llvm::Type *AllocType,
+                                      llvm::Value *Step) {
+    if (!Step || llvm::isa<llvm::Constant>(Step)) {
+      return Step;
+    }
+
+    // A void pointer says nothing about the size of the cells.
+    llvm::PointerType *PT = llvm::dyn_cast<llvm::PointerType>(AllocType);
+    if (!PT || AllocType == llvm::Type::getInt8PtrTy(*Context) ||
+        !PT->getElementType()->isSized()) {
+      return Step;
+    }
+
+    uint64_t ETSize = DL.getTypeAllocSize(PT->getElementType());
+    if (ETSize == 0) {
+      return Step;
+    }
+
+    return llvm::ConstantInt::get(Step->getType(), ETSize);
+  }
+
   /// Builds the types required by the pass for the given context.
   void buildTypes(void) {
     // Create the RsLaunchDimensionsTy and RsExpandKernelDriverInfoPfxTy structs.
@@ -298,6 +365,43 @@ private:
     ExpandedFunctionType =
         llvm::FunctionType::get(llvm::Type::getVoidTy(*Context), ParamTypes,
                                 false);
+
+    /* Defined in RSExpandTile.h:
+     *
+     * struct RsExpandTile {
+     *   uint32_t x1, x2, y1, y2, z1, z2;
+     *   uint32_t outRowStride;
+     *   uint32_t outSliceStride;
+     *   uint32_t inRowStride[RS_KERNEL_INPUT_LIMIT];
+     *   uint32_t inSliceStride[RS_KERNEL_INPUT_LIMIT];
+     * };
+     */
+    llvm::SmallVector<llvm::Type*, RsExpandTileFieldCount> RsExpandTileTypes;
+    RsExpandTileTypes.append(6, Int32Ty);                 // uint32_t x1, ..., z2
+    RsExpandTileTypes.push_back(Int32Ty);                 // uint32_t outRowStride
+    RsExpandTileTypes.push_back(Int32Ty);                 // uint32_t outSliceStride
+    RsExpandTileTypes.push_back(Int32ArrayInputLimitTy);  // uint32_t inRowStride[RS_KERNEL_INPUT_LIMIT]
+    RsExpandTileTypes.push_back(Int32ArrayInputLimitTy);  // uint32_t inSliceStride[RS_KERNEL_INPUT_LIMIT]
+    llvm::StructType *RsExpandTileTy =
+        llvm::StructType::create(RsExpandTileTypes, "RsExpandTile");
+
+    llvm::SmallVector<llvm::Type*, 2> TileParamTypes;
+    TileParamTypes.push_back(RsExpandKernelDriverInfoPfxPtrTy); // const RsExpandKernelDriverInfoPfx *p
+    TileParamTypes.push_back(RsExpandTileTy->getPointerTo());   // const RsExpandTile *tile
+
+    ExpandedTileFunctionType =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(*Context),
+                                TileParamTypes, false);
+
+    llvm::SmallVector<llvm::Type*, 4> AccumulatorParamTypes;
+    AccumulatorParamTypes.push_back(RsExpandKernelDriverInfoPfxPtrTy); // const RsExpandKernelDriverInfoPfx *p
+    AccumulatorParamTypes.push_back(Int32Ty);                          // uint32_t x1
+    AccumulatorParamTypes.push_back(Int32Ty);                          // uint32_t x2
+    AccumulatorParamTypes.push_back(Int8PtrTy);                        // uint8_t *accum
+
+    ExpandedAccumulatorType =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(*Context),
+                                AccumulatorParamTypes, false);
   }
 
   /// @brief Create skeleton of the expanded function.
@@ -307,20 +411,61 @@ private:
   ///   void (const RsForEachStubParamStruct *p, uint32_t x1, uint32_t x2,
   ///         uint32_t outstep)
   ///
-  llvm::Function *createEmptyExpandedFunction(llvm::StringRef OldName) {
+  /// or, for the tiled variant named <OldName>.expand.tile:
+  ///
+  ///   void (const RsForEachStubParamStruct *p, const RsExpandTile *tile)
+  ///
+  llvm::Function *createEmptyExpandedFunction(llvm::StringRef OldName,
+                                              bool Tile = false) {
     llvm::Function *ExpandedFunction =
-      llvm::Function::Create(ExpandedFunctionType,
+      llvm::Function::Create(Tile ? ExpandedTileFunctionType
+                                  : ExpandedFunctionType,
                              llvm::GlobalValue::ExternalLinkage,
-                             OldName + ".expand", Module);
+                             OldName + (Tile ? ".expand.tile" : ".expand"),
+                             Module);
 
-    bccAssert(ExpandedFunction->arg_size() == NUM_EXPANDED_FUNCTION_PARAMS);
+    llvm::Function::arg_iterator AI = ExpandedFunction->arg_begin();
+
+    if (Tile) {
+      (AI++)->setName("p");
+      (AI++)->setName("tile");
+    } else {
+      bccAssert(ExpandedFunction->arg_size() == NUM_EXPANDED_FUNCTION_PARAMS);
+
+      (AI++)->setName("p");
+      (AI++)->setName("x1");
+      (AI++)->setName("x2");
+      (AI++)->setName("arg_outstep");
+    }
+
+    llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*Context, "Begin",
+                                                       ExpandedFunction);
+    llvm::IRBuilder<> Builder(Begin);
+    Builder.CreateRetVoid();
+
+    return ExpandedFunction;
+  }
+
+  /// @brief Create skeleton of the expanded accumulator of a reduction
+  /// kernel.
+  ///
+  /// This creates a function named <OldName>.expand with the signature:
+  ///
+  ///   void (const RsExpandKernelDriverInfoPfx *p, uint32_t x1, uint32_t x2,
+  ///         uint8_t *accum)
+  ///
+  llvm::Function *createEmptyExpandedAccumulator(llvm::StringRef OldName) {
+    llvm::Function *ExpandedFunction =
+      llvm::Function::Create(ExpandedAccumulatorType,
+                             llvm::GlobalValue::ExternalLinkage,
+                             OldName + ".expand", Module);
 
     llvm::Function::arg_iterator AI = ExpandedFunction->arg_begin();
 
     (AI++)->setName("p");
     (AI++)->setName("x1");
     (AI++)->setName("x2");
-    (AI++)->setName("arg_outstep");
+    (AI++)->setName("accum");
 
     llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*Context, "Begin",
                                                        ExpandedFunction);
@@ -330,13 +475,138 @@ private:
     return ExpandedFunction;
   }
 
+  /// @brief Create the metadata for the accesses of an expanded kernel
+  ///
+  /// @param TBAAAllocation Set to the TBAA tag of the cells of allocations.
+  /// @param TBAAPointer Set to the TBAA tag of the pointers to allocations.
+  /// @param AliasingScope Set to a new alias scope for the kernel arguments.
+  void createAllocationMetadata(llvm::MDNode **TBAAAllocation,
+                                llvm::MDNode **TBAAPointer,
+                                llvm::MDNode **AliasingScope) {
+    llvm::MDNode *TBAARenderScriptDistinct, *TBAARenderScript;
+    llvm::MDBuilder MDHelper(*Context);
+
+    TBAARenderScriptDistinct =
+      MDHelper.createTBAARoot("RenderScript Distinct TBAA");
+    TBAARenderScript = MDHelper.createTBAANode("RenderScript TBAA",
+        TBAARenderScriptDistinct);
+    *TBAAAllocation = MDHelper.createTBAAScalarTypeNode("allocation",
+                                                        TBAARenderScript);
+    *TBAAAllocation = MDHelper.createTBAAStructTagNode(*TBAAAllocation,
+                                                       *TBAAAllocation, 0);
+    *TBAAPointer = MDHelper.createTBAAScalarTypeNode("pointer",
+                                                     TBAARenderScript);
+    *TBAAPointer = MDHelper.createTBAAStructTagNode(*TBAAPointer,
+                                                    *TBAAPointer, 0);
+
+    llvm::MDNode *AliasingDomain;
+    AliasingDomain = MDHelper.createAnonymousAliasScopeDomain("RS argument scope domain");
+    *AliasingScope = MDHelper.createAnonymousAliasScope(AliasingDomain, "RS argument scope");
+  }
+
+  /// @brief Collect the accesses of a legacy kernel to its current cells
+  ///
+  /// Follows the uses of Ptr, which points Offset bytes into a cell of
+  /// CellSize bytes, through bitcasts and constant GEPs. Returns true if they
+  /// all end in loads from or stores to the cell; these are added to
+  /// Accesses. Returns false as soon as Ptr is stored, passed to a call,
+  /// compared, converted or offset outside of the cell.
+  bool collectCellAccesses(const llvm::DataLayout &DL, llvm::Value *Ptr,
+                           int64_t Offset, uint64_t CellSize,
+                           llvm::SmallVectorImpl<llvm::Instruction*> &Accesses) {
+    auto FitsInCell = [&](llvm::Type *AccessTy) {
+      return Offset >= 0 &&
+             (uint64_t)Offset + DL.getTypeStoreSize(AccessTy) <= CellSize;
+    };
+
+    for (llvm::User *U : Ptr->users()) {
+      if (auto *Load = llvm::dyn_cast<llvm::LoadInst>(U)) {
+        if (!FitsInCell(Load->getType())) {
+          return false;
+        }
+        Accesses.push_back(Load);
+      } else if (auto *Store = llvm::dyn_cast<llvm::StoreInst>(U)) {
+        if (Store->getValueOperand() == Ptr ||
+            !FitsInCell(Store->getValueOperand()->getType())) {
+          return false;
+        }
+        Accesses.push_back(Store);
+      } else if (auto *Cast = llvm::dyn_cast<llvm::BitCastInst>(U)) {
+        if (!collectCellAccesses(DL, Cast, Offset, CellSize, Accesses)) {
+          return false;
+        }
+      } else if (auto *GEP = llvm::dyn_cast<llvm::GetElementPtrInst>(U)) {
+        llvm::APInt GEPOffset(DL.getPointerSizeInBits(), 0);
+        if (GEP->getPointerOperand() != Ptr ||
+            !GEP->accumulateConstantOffset(DL, GEPOffset) ||
+            !collectCellAccesses(DL, GEP, Offset + GEPOffset.getSExtValue(),
+                                 CellSize, Accesses)) {
+          return false;
+        }
+      } else {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  /// @brief Collect the accesses of a legacy kernel to its input and output
+  ///
+  /// Returns true if the old-style kernel Function, say
+  /// root(const T *in, T *out, ...), only loads from *in and stores to (or
+  /// loads from) *out: the pointers neither escape nor are offset beyond the
+  /// current cell. The kernel must also not be called from anywhere else, so
+  /// that the pointers always point into allocations. The loads and stores
+  /// are added to Accesses (if not null).
+  bool collectLegacyCellAccesses(llvm::Function *Function, uint32_t Signature,
+                                 llvm::SmallVectorImpl<llvm::Instruction*> *Accesses) {
+    if (Function->isDeclaration() || !Function->use_empty() ||
+        !Function->getReturnType()->isVoidTy()) {
+      return false;
+    }
+
+    llvm::DataLayout DL(Module);
+    llvm::Type *VoidPtrTy = llvm::Type::getInt8PtrTy(*Context);
+    llvm::SmallVector<llvm::Instruction*, 16> CellAccesses;
+
+    size_t NumCellArgs =
+        bcinfo::MetadataExtractor::hasForEachSignatureIn(Signature) +
+        bcinfo::MetadataExtractor::hasForEachSignatureOut(Signature);
+    if (Function->arg_size() < NumCellArgs) {
+      return false;
+    }
+
+    llvm::Function::arg_iterator ArgIter = Function->arg_begin();
+    for (size_t i = 0; i < NumCellArgs; ++i, ++ArgIter) {
+      // The cells behind a void pointer have no known size.
+      llvm::PointerType *PT =
+          llvm::dyn_cast<llvm::PointerType>(ArgIter->getType());
+      if (!PT || PT == VoidPtrTy || !PT->getElementType()->isSized()) {
+        return false;
+      }
+
+      uint64_t CellSize = DL.getTypeAllocSize(PT->getElementType());
+      if (!collectCellAccesses(DL, &*ArgIter, 0, CellSize, CellAccesses)) {
+        return false;
+      }
+    }
+
+    if (Accesses) {
+      Accesses->append(CellAccesses.begin(), CellAccesses.end());
+    }
+    return true;
+  }
+
   /// @brief Create an empty loop
   ///
   /// Create a loop of the form:
   ///
-  /// for (i = LowerBound; i < UpperBound; i++)
+  /// for (i = LowerBound; i < UpperBound; i += Step)
   ///   ;
   ///
+  /// UpperBound - LowerBound must be a multiple of Step.
+  ///
   /// After the loop has been created, the builder is set such that
   /// instructions can be added to the loop body.
   ///
@@ -346,11 +616,13 @@ private:
   /// @param LowerBound The first value of the loop iterator
   /// @param UpperBound The maximal value of the loop iterator
   /// @param LoopIV A reference that will be set to the loop iterator.
+  /// @param Step The increment of the loop iterator
   /// @return The BasicBlock that will be executed after the loop.
   llvm::BasicBlock *createLoop(llvm::IRBuilder<> &Builder,
                                llvm::Value *LowerBound,
                                llvm::Value *UpperBound,
-                               llvm::PHINode **LoopIV) {
+                               llvm::PHINode **LoopIV,
+                               unsigned Step = 1) {
     assert(LowerBound->getType() == UpperBound->getType());
 
     llvm::BasicBlock *CondBB, *AfterBB, *HeaderBB;
@@ -371,7 +643,7 @@ private:
     Builder.CreateCondBr(Cond, HeaderBB, AfterBB);
 
     // iv = PHI [CondBB -> LowerBound], [LoopHeader -> NextIV ]
-    // iv.next = iv + 1
+    // iv.next = iv + Step
     // if (iv.next < Upperbound)
     //   goto LoopHeader
     // else
@@ -379,7 +651,7 @@ private:
     Builder.SetInsertPoint(HeaderBB);
     IV = Builder.CreatePHI(LowerBound->getType(), 2, "X");
     IV->addIncoming(LowerBound, CondBB);
-    IVNext = Builder.CreateNUWAdd(IV, Builder.getInt32(1));
+    IVNext = Builder.CreateNUWAdd(IV, Builder.getInt32(Step));
     IV->addIncoming(IVNext, HeaderBB);
     Cond = Builder.CreateICmpULT(IVNext, UpperBound);
     Builder.CreateCondBr(Cond, HeaderBB, AfterBB);
@@ -427,10 +699,66 @@ private:
     }
   }
 
+  // The largest kernel (in instructions) ExpandKernel() replicates in a
+  // widened loop body, and the number of bytes of each allocation a widened
+  // iteration should cover: one 128-bit vector register.
+  static const size_t MaxWidenedKernelSize = 64;
+  static const uint64_t WidenedLoopBytes = 16;
+
+  /// @brief Get the number of cells per iteration of the main loop of an
+  /// expanded kernel.
+  ///
+  /// Returns 1 unless the kernel is small, can be inlined and only takes and
+  /// returns its cells by value. Otherwise the cells per iteration are chosen
+  /// (4, 8 or 16) so that the smallest cell type fills a vector register.
+  /// Calling the kernel that many times in a row, on consecutive cells,
+  /// gives the SLP vectorizer the straight-line code it needs once the
+  /// kernel is inlined; a remainder loop handles the last cells.
+  ///
+  /// @param Kernel The kernel being expanded
+  /// @param CellTypes The types of the input and output cells
+  unsigned getKernelLoopWidth(const llvm::DataLayout &DL,
+                              const llvm::Function *Kernel,
+                              llvm::ArrayRef<llvm::Type *> CellTypes) {
+    if (!mWidenKernelLoops || CellTypes.empty() || Kernel->isDeclaration() ||
+        Kernel->hasFnAttribute(llvm::Attribute::NoInline)) {
+      return 1;
+    }
+
+    size_t KernelSize = 0;
+    for (const llvm::BasicBlock &BB : *Kernel) {
+      KernelSize += BB.size();
+    }
+    if (KernelSize > MaxWidenedKernelSize) {
+      return 1;
+    }
+
+    uint64_t MinCellSize = WidenedLoopBytes;
+    for (llvm::Type *CellType : CellTypes) {
+      uint64_t CellSize = DL.getTypeAllocSize(CellType);
+      if (CellSize == 0) {
+        return 1;
+      }
+      MinCellSize = std::min(MinCellSize, CellSize);
+    }
+
+    unsigned Width = WidenedLoopBytes / MinCellSize;
+    if (Width >= 16) {
+      return 16;
+    } else if (Width >= 8) {
+      return 8;
+    }
+    return 4;
+  }
+
 public:
-  RSForEachExpandPass(bool pEnableStepOpt = true)
+  RSForEachExpandPass(bool pEnableStepOpt = true,
+                      const bcinfo::MetadataExtractor *pMetadata = nullptr,
+                      bool pWidenKernelLoops = false,
+                      bool pExpandTiles = false)
       : ModulePass(ID), Module(nullptr), Context(nullptr),
-        mEnableStepOpt(pEnableStepOpt) {
+        mEnableStepOpt(pEnableStepOpt), mWidenKernelLoops(pWidenKernelLoops),
+        mExpandTiles(pExpandTiles), mMetadata(pMetadata) {
 
   }
 
@@ -448,6 +776,8 @@ public:
   //            suitable for computing arguments for the ForEach-able function
   // CalleeArgs - contribution is accumulated here
   // Bump - invoked once for each contributed outgoing argument
+  // Y, Z - if not null, the coordinates to pass instead of the ones of the
+  //        current cell in Arg_p
   //
   // Return value is the (zero-based) position of the context (Arg_p)
   // argument in the CalleeArgs vector, or a negative value if the
@@ -457,7 +787,9 @@ public:
                              llvm::Value *Arg_p,
                              llvm::IRBuilder<> &Builder,
                              llvm::SmallVector<llvm::Value*, 8> &CalleeArgs,
-                             std::function<void ()> Bump) {
+                             std::function<void ()> Bump,
+                             llvm::Value *Y = nullptr,
+                             llvm::Value *Z = nullptr) {
 
     bccAssert(CalleeArgs.empty());
 
@@ -479,16 +811,20 @@ public:
       llvm::Value *Current = Builder.CreateStructGEP(nullptr, Arg_p, RsExpandKernelDriverInfoPfxFieldCurrent);
 
       if (bcinfo::MetadataExtractor::hasForEachSignatureY(Signature)) {
-        llvm::Value *Y = Builder.CreateLoad(
-            Builder.CreateStructGEP(nullptr, Current, RsLaunchDimensionsFieldY), "Y");
+        if (Y == nullptr) {
+          Y = Builder.CreateLoad(
+              Builder.CreateStructGEP(nullptr, Current, RsLaunchDimensionsFieldY), "Y");
+        }
 
         CalleeArgs.push_back(Y);
         Bump();
       }
 
       if (bcinfo::MetadataExtractor::hasForEachSignatureZ(Signature)) {
-        llvm::Value *Z = Builder.CreateLoad(
-            Builder.CreateStructGEP(nullptr, Current, RsLaunchDimensionsFieldZ), "Z");
+        if (Z == nullptr) {
+          Z = Builder.CreateLoad(
+              Builder.CreateStructGEP(nullptr, Current, RsLaunchDimensionsFieldZ), "Z");
+        }
         CalleeArgs.push_back(Z);
         Bump();
       }
@@ -516,6 +852,32 @@ public:
 
     llvm::DataLayout DL(Module);
 
+    // If the kernel accesses nothing but its current cells through its input
+    // and output, annotate those accesses (and the loads of the base
+    // pointers below) the way ExpandKernel() does for pass-by-value kernels.
+    llvm::SmallVector<llvm::Instruction*, 16> CellAccesses;
+    llvm::MDNode *TBAAAllocation = nullptr, *TBAAPointer = nullptr,
+                 *AliasingScope = nullptr;
+    if (collectLegacyCellAccesses(Function, Signature, &CellAccesses)) {
+      createAllocationMetadata(&TBAAAllocation, &TBAAPointer, &AliasingScope);
+      for (llvm::Instruction *Access : CellAccesses) {
+        if (gEnableRsTbaa) {
+          Access->setMetadata("tbaa", TBAAAllocation);
+        }
+        Access->setMetadata("alias.scope", AliasingScope);
+      }
+    }
+
+    auto annotateBasePtr = [&](llvm::LoadInst *BasePtr) {
+      if (!AliasingScope) {
+        return;
+      }
+      if (gEnableRsTbaa) {
+        BasePtr->setMetadata("tbaa", TBAAPointer);
+      }
+      BasePtr->setMetadata("alias.scope", AliasingScope);
+    };
+
     llvm::Function *ExpandedFunction =
       createEmptyExpandedFunction(Function->getName());
 
@@ -561,7 +923,9 @@ public:
       InStep->setName("instep");
 
       llvm::Value *InputAddr = Builder.CreateConstInBoundsGEP2_32(nullptr, InsBasePtr, 0, 0);
-      InBasePtr = Builder.CreateLoad(InputAddr, "input_base");
+      llvm::LoadInst *InBasePtrLoad = Builder.CreateLoad(InputAddr, "input_base");
+      annotateBasePtr(InBasePtrLoad);
+      InBasePtr = InBasePtrLoad;
     }
 
     llvm::Type *OutTy = nullptr;
@@ -570,10 +934,12 @@ public:
       OutTy = (FunctionArgIter++)->getType();
       OutStep = getStepValue(&DL, OutTy, Arg_outstep);
       OutStep->setName("outstep");
-      OutBasePtr = Builder.CreateLoad(
+      llvm::LoadInst *OutBasePtrLoad = Builder.CreateLoad(
                      Builder.CreateConstInBoundsGEP2_32(nullptr,
                          Builder.CreateStructGEP(nullptr, Arg_p, RsExpandKernelDriverInfoPfxFieldOutPtr),
                          0, 0));
+      annotateBasePtr(OutBasePtrLoad);
+      OutBasePtr = OutBasePtrLoad;
     }
 
     llvm::Value *UsrData = nullptr;
@@ -584,112 +950,180 @@ public:
       UsrData->setName("UsrData");
     }
 
-    llvm::PHINode *IV;
-    createLoop(Builder, Arg_x1, Arg_x2, &IV);
+    // Emits the loop over the cells x1 to x2 at the builder's position,
+    // stepping through the input and output by InLoopStep and OutLoopStep
+    // bytes.
+    auto ExpandLoop = [&](llvm::Value *InLoopStep, llvm::Value *OutLoopStep) {
+      llvm::PHINode *IV;
+      createLoop(Builder, Arg_x1, Arg_x2, &IV);
+
+      // The special arguments are the last parameters of the function.
+      llvm::Function::arg_iterator SpecialArgIter = FunctionArgIter;
+      llvm::SmallVector<llvm::Value*, 8> CalleeArgs;
+      const int CalleeArgsContextIdx = ExpandSpecialArguments(Signature, IV, Arg_p, Builder, CalleeArgs,
+                                                              [&SpecialArgIter]() { SpecialArgIter++; });
+
+      bccAssert(SpecialArgIter == Function->arg_end());
+
+      // Populate the actual call to kernel().
+      llvm::SmallVector<llvm::Value*, 8> RootArgs;
+
+      llvm::Value *InPtr  = nullptr;
+      llvm::Value *OutPtr = nullptr;
+
+      // Calculate the current input and output pointers
+      //
+      // We always calculate the input/output pointers with a GEP operating on i8
+      // values and only cast at the very end to OutTy. This is because the step
+      // between two values is given in bytes.
+      //
+      // TODO: We could further optimize the output by using a GEP operation of
+      // type 'OutTy' in cases where the element type of the allocation allows.
+      if (OutBasePtr) {
+        llvm::Value *OutOffset = Builder.CreateSub(IV, Arg_x1);
+        OutOffset = Builder.CreateMul(OutOffset, OutLoopStep);
+        OutPtr = Builder.CreateGEP(OutBasePtr, OutOffset);
+        OutPtr = Builder.CreatePointerCast(OutPtr, OutTy);
+      }
 
-    llvm::SmallVector<llvm::Value*, 8> CalleeArgs;
-    const int CalleeArgsContextIdx = ExpandSpecialArguments(Signature, IV, Arg_p, Builder, CalleeArgs,
-                                                            [&FunctionArgIter]() { FunctionArgIter++; });
+      if (InBasePtr) {
+        llvm::Value *InOffset = Builder.CreateSub(IV, Arg_x1);
+        InOffset = Builder.CreateMul(InOffset, InLoopStep);
+        InPtr = Builder.CreateGEP(InBasePtr, InOffset);
+        InPtr = Builder.CreatePointerCast(InPtr, InTy);
+      }
 
-    bccAssert(FunctionArgIter == Function->arg_end());
+      if (InPtr) {
+        RootArgs.push_back(InPtr);
+      }
 
-    // Populate the actual call to kernel().
-    llvm::SmallVector<llvm::Value*, 8> RootArgs;
+      if (OutPtr) {
+        RootArgs.push_back(OutPtr);
+      }
 
-    llvm::Value *InPtr  = nullptr;
-    llvm::Value *OutPtr = nullptr;
+      if (UsrData) {
+        RootArgs.push_back(UsrData);
+      }
 
-    // Calculate the current input and output pointers
-    //
-    // We always calculate the input/output pointers with a GEP operating on i8
-    // values and only cast at the very end to OutTy. This is because the step
-    // between two values is given in bytes.
-    //
-    // TODO: We could further optimize the output by using a GEP operation of
-    // type 'OutTy' in cases where the element type of the allocation allows.
-    if (OutBasePtr) {
-      llvm::Value *OutOffset = Builder.CreateSub(IV, Arg_x1);
-      OutOffset = Builder.CreateMul(OutOffset, OutStep);
-      OutPtr = Builder.CreateGEP(OutBasePtr, OutOffset);
-      OutPtr = Builder.CreatePointerCast(OutPtr, OutTy);
-    }
+      finishArgList(RootArgs, CalleeArgs, CalleeArgsContextIdx, *Function, Builder);
 
-    if (InBasePtr) {
-      llvm::Value *InOffset = Builder.CreateSub(IV, Arg_x1);
-      InOffset = Builder.CreateMul(InOffset, InStep);
-      InPtr = Builder.CreateGEP(InBasePtr, InOffset);
-      InPtr = Builder.CreatePointerCast(InPtr, InTy);
-    }
+      Builder.CreateCall(Function, RootArgs);
+    };
 
-    if (InPtr) {
-      RootArgs.push_back(InPtr);
-    }
+    // A step getStepValue() could not make constant is almost always the
+    // alloc size of the element type anyway. Guard a copy of the loop that
+    // uses that size as a constant step, so the optimizer can treat it as a
+    // unit-stride loop, and keep the loop with the driver's steps as the
+    // fallback.
+    llvm::Value *FastInStep  = getContiguousStepValue(DL, InTy, InStep);
+    llvm::Value *FastOutStep = getContiguousStepValue(DL, OutTy, OutStep);
 
-    if (OutPtr) {
-      RootArgs.push_back(OutPtr);
+    llvm::Value *StepsContiguous = nullptr;
+    if (FastInStep != InStep) {
+      StepsContiguous = Builder.CreateICmpEQ(InStep, FastInStep);
+    }
+    if (FastOutStep != OutStep) {
+      llvm::Value *OutContiguous = Builder.CreateICmpEQ(OutStep, FastOutStep);
+      StepsContiguous = StepsContiguous ?
+          Builder.CreateAnd(StepsContiguous, OutContiguous) : OutContiguous;
     }
 
-    if (UsrData) {
-      RootArgs.push_back(UsrData);
+    if (!StepsContiguous) {
+      ExpandLoop(InStep, OutStep);
+      return true;
     }
 
-    finishArgList(RootArgs, CalleeArgs, CalleeArgsContextIdx, *Function, Builder);
+    StepsContiguous->setName("steps_contiguous");
+
+    llvm::BasicBlock *GuardBB = Builder.GetInsertBlock();
+    llvm::BasicBlock *ExitBB = llvm::SplitBlock(GuardBB, Builder.GetInsertPoint(), nullptr, nullptr);
+    llvm::BasicBlock *ContiguousBB = llvm::BasicBlock::Create(*Context, "ContiguousSteps", ExpandedFunction, ExitBB);
+    llvm::BasicBlock *GenericBB = llvm::BasicBlock::Create(*Context, "GenericSteps", ExpandedFunction, ExitBB);
+
+    GuardBB->getTerminator()->eraseFromParent();
+    Builder.SetInsertPoint(GuardBB);
+    Builder.CreateCondBr(StepsContiguous, ContiguousBB, GenericBB);
 
-    Builder.CreateCall(Function, RootArgs);
+    Builder.SetInsertPoint(ContiguousBB);
+    Builder.SetInsertPoint(Builder.CreateBr(ExitBB));
+    ExpandLoop(FastInStep, FastOutStep);
+
+    Builder.SetInsertPoint(GenericBB);
+    Builder.SetInsertPoint(Builder.CreateBr(ExitBB));
+    ExpandLoop(InStep, OutStep);
 
     return true;
   }
 
   /* Expand a pass-by-value kernel.
    */
-  bool ExpandKernel(llvm::Function *Function, uint32_t Signature) {
+  /* Performs the actual optimization on a selected kernel. On success, the
+   * Module will contain a new function of the name "<NAME>.expand" (or, if
+   * Tile is true, "<NAME>.expand.tile") that invokes <NAME>() in a loop (or
+   * in nested loops over the rows and slices of the tile).
+   */
+  bool ExpandKernel(llvm::Function *Function, uint32_t Signature,
+                    bool Tile = false) {
     bccAssert(bcinfo::MetadataExtractor::hasForEachSignatureKernel(Signature));
-    ALOGV("Expanding kernel Function %s", Function->getName().str().c_str());
+    ALOGV("Expanding kernel Function %s%s", Function->getName().str().c_str(),
+          Tile ? " (tiled)" : "");
 
     // TODO: Refactor this to share functionality with ExpandFunction.
     llvm::DataLayout DL(Module);
 
     llvm::Function *ExpandedFunction =
-      createEmptyExpandedFunction(Function->getName());
+      createEmptyExpandedFunction(Function->getName(), Tile);
 
     /*
      * Extract the expanded function's parameters.  It is guaranteed by
      * createEmptyExpandedFunction that there will be five parameters.
      */
 
-    bccAssert(ExpandedFunction->arg_size() == NUM_EXPANDED_FUNCTION_PARAMS);
-
     llvm::Function::arg_iterator ExpandedFunctionArgIter =
       ExpandedFunction->arg_begin();
 
     llvm::Value *Arg_p       = &*(ExpandedFunctionArgIter++);
-    llvm::Value *Arg_x1      = &*(ExpandedFunctionArgIter++);
-    llvm::Value *Arg_x2      = &*(ExpandedFunctionArgIter++);
-    llvm::Value *Arg_outstep = &*(ExpandedFunctionArgIter);
+    llvm::Value *Arg_x1      = nullptr;
+    llvm::Value *Arg_x2      = nullptr;
+    llvm::Value *Arg_outstep = nullptr;
 
     // Construct the actual function body.
     llvm::IRBuilder<> Builder(ExpandedFunction->getEntryBlock().begin());
 
-    // Create TBAA meta-data.
-    llvm::MDNode *TBAARenderScriptDistinct, *TBAARenderScript,
-                 *TBAAAllocation, *TBAAPointer;
-    llvm::MDBuilder MDHelper(*Context);
+    // The tile bounds and strides; only for tiled expansion.
+    llvm::Value *Arg_tile = nullptr;
+    llvm::Value *Tile_y1 = nullptr, *Tile_y2 = nullptr;
+    llvm::Value *Tile_z1 = nullptr, *Tile_z2 = nullptr;
+
+    auto loadTileField = [&](unsigned Field, const char *Name) {
+      return Builder.CreateLoad(
+          Builder.CreateStructGEP(nullptr, Arg_tile, Field), Name);
+    };
+
+    if (Tile) {
+      Arg_tile = &*ExpandedFunctionArgIter;
+      Arg_x1 = loadTileField(RsExpandTileFieldX1, "x1");
+      Arg_x2 = loadTileField(RsExpandTileFieldX2, "x2");
+      Tile_y1 = loadTileField(RsExpandTileFieldY1, "y1");
+      Tile_y2 = loadTileField(RsExpandTileFieldY2, "y2");
+      Tile_z1 = loadTileField(RsExpandTileFieldZ1, "z1");
+      Tile_z2 = loadTileField(RsExpandTileFieldZ2, "z2");
+      // The .expand functions get this as an argument from the driver.
+      Arg_outstep = Builder.CreateLoad(
+          Builder.CreateConstInBoundsGEP2_32(nullptr,
+              Builder.CreateStructGEP(nullptr, Arg_p, RsExpandKernelDriverInfoPfxFieldOutStride),
+              0, 0), "arg_outstep");
+    } else {
+      bccAssert(ExpandedFunction->arg_size() == NUM_EXPANDED_FUNCTION_PARAMS);
 
-    TBAARenderScriptDistinct =
-      MDHelper.createTBAARoot("RenderScript Distinct TBAA");
-    TBAARenderScript = MDHelper.createTBAANode("RenderScript TBAA",
-        TBAARenderScriptDistinct);
-    TBAAAllocation = MDHelper.createTBAAScalarTypeNode("allocation",
-                                                       TBAARenderScript);
-    TBAAAllocation = MDHelper.createTBAAStructTagNode(TBAAAllocation,
-                                                      TBAAAllocation, 0);
-    TBAAPointer = MDHelper.createTBAAScalarTypeNode("pointer",
-                                                    TBAARenderScript);
-    TBAAPointer = MDHelper.createTBAAStructTagNode(TBAAPointer, TBAAPointer, 0);
-
-    llvm::MDNode *AliasingDomain, *AliasingScope;
-    AliasingDomain = MDHelper.createAnonymousAliasScopeDomain("RS argument scope domain");
-    AliasingScope = MDHelper.createAnonymousAliasScope(AliasingDomain, "RS argument scope");
+      Arg_x1      = &*(ExpandedFunctionArgIter++);
+      Arg_x2      = &*(ExpandedFunctionArgIter++);
+      Arg_outstep = &*(ExpandedFunctionArgIter);
+    }
+
+    // Create TBAA meta-data.
+    llvm::MDNode *TBAAAllocation, *TBAAPointer, *AliasingScope;
+    createAllocationMetadata(&TBAAAllocation, &TBAAPointer, &AliasingScope);
 
     /*
      * Collect and construct the arguments for the kernel().
@@ -742,12 +1176,20 @@ public:
       CastedOutBasePtr = Builder.CreatePointerCast(OutBasePtr, OutTy, "casted_out");
     }
 
-    llvm::PHINode *IV;
-    createLoop(Builder, Arg_x1, Arg_x2, &IV);
-
-    llvm::SmallVector<llvm::Value*, 8> CalleeArgs;
-    const int CalleeArgsContextIdx = ExpandSpecialArguments(Signature, IV, Arg_p, Builder, CalleeArgs,
-                                                            [&NumInputs]() { --NumInputs; });
+    // The special arguments take the place of inputs among the parameters of
+    // the kernel.
+    if (bcinfo::MetadataExtractor::hasForEachSignatureCtxt(Signature)) {
+      --NumInputs;
+    }
+    if (bcinfo::MetadataExtractor::hasForEachSignatureX(Signature)) {
+      --NumInputs;
+    }
+    if (bcinfo::MetadataExtractor::hasForEachSignatureY(Signature)) {
+      --NumInputs;
+    }
+    if (bcinfo::MetadataExtractor::hasForEachSignatureZ(Signature)) {
+      --NumInputs;
+    }
 
     llvm::SmallVector<llvm::Type*,  8> InTypes;
     llvm::SmallVector<llvm::Value*, 8> InSteps;
@@ -816,86 +1258,413 @@ public:
       }
     }
 
-    // Populate the actual call to kernel().
-    llvm::SmallVector<llvm::Value*, 8> RootArgs;
+    // Emits the call of kernel() for the cell at X, at the builder's position.
+    // Y and Z are the coordinates of the row (or null to use the current
+    // ones), whose cells start at OutRowBase and InRowBases.
+    auto ExpandCell = [&](llvm::Value *X, llvm::Value *Y, llvm::Value *Z,
+                          llvm::Value *OutRowBase,
+                          llvm::ArrayRef<llvm::Value*> InRowBases) {
+      llvm::SmallVector<llvm::Value*, 8> CalleeArgs;
+      const int CalleeArgsContextIdx = ExpandSpecialArguments(Signature, X, Arg_p, Builder, CalleeArgs,
+                                                              []() { }, Y, Z);
+
+      // Populate the actual call to kernel().
+      llvm::SmallVector<llvm::Value*, 8> RootArgs;
+
+      // Calculate the current input and output pointers
+      //
+      //
+      // We always calculate the input/output pointers with a GEP operating on i8
+      // values combined with a multiplication and only cast at the very end to
+      // OutTy.  This is to account for dynamic stepping sizes when the value
+      // isn't apparent at compile time.  In the (very common) case when we know
+      // the step size at compile time, due to haveing complete type information
+      // this multiplication will optmized out and produces code equivalent to a
+      // a GEP on a pointer of the correct type.
+
+      // Output
+
+      llvm::Value *OutPtr = nullptr;
+      if (OutRowBase) {
+        llvm::Value *OutOffset = Builder.CreateSub(X, Arg_x1);
+
+        OutPtr    = Builder.CreateGEP(OutRowBase, OutOffset);
+
+        if (PassOutByPointer) {
+          RootArgs.push_back(OutPtr);
+        }
+      }
 
-    // Calculate the current input and output pointers
-    //
-    //
-    // We always calculate the input/output pointers with a GEP operating on i8
-    // values combined with a multiplication and only cast at the very end to
-    // OutTy.  This is to account for dynamic stepping sizes when the value
-    // isn't apparent at compile time.  In the (very common) case when we know
-    // the step size at compile time, due to haveing complete type information
-    // this multiplication will optmized out and produces code equivalent to a
-    // a GEP on a pointer of the correct type.
+      // Inputs
 
-    // Output
+      if (NumInputs > 0) {
+        llvm::Value *Offset = Builder.CreateSub(X, Arg_x1);
 
-    llvm::Value *OutPtr = nullptr;
-    if (CastedOutBasePtr) {
-      llvm::Value *OutOffset = Builder.CreateSub(IV, Arg_x1);
+        for (size_t Index = 0; Index < NumInputs; ++Index) {
+          llvm::Value *InPtr    = Builder.CreateGEP(InRowBases[Index], Offset);
+          llvm::Value *Input;
 
-      OutPtr    = Builder.CreateGEP(CastedOutBasePtr, OutOffset);
+          if (llvm::Value *TemporarySlot = InStructTempSlots[Index]) {
+            // Pass a pointer to a temporary on the stack, rather than
+            // passing a pointer to the original value. We do not want
+            // the kernel to potentially modify the input data.
 
-      if (PassOutByPointer) {
-        RootArgs.push_back(OutPtr);
+            llvm::Type *ElementType = llvm::cast<llvm::PointerType>(
+                                          InPtr->getType())->getElementType();
+            uint64_t StoreSize = DL.getTypeStoreSize(ElementType);
+            uint64_t Alignment = DL.getABITypeAlignment(ElementType);
+
+            Builder.CreateMemCpy(TemporarySlot, InPtr, StoreSize, Alignment,
+                                 /* isVolatile = */ false,
+                                 /* !tbaa = */ gEnableRsTbaa ? TBAAAllocation : nullptr,
+                                 /* !tbaa.struct = */ nullptr,
+                                 /* !alias.scope = */ AliasingScope);
+            Input = TemporarySlot;
+          } else {
+            llvm::LoadInst *InputLoad = Builder.CreateLoad(InPtr, "input");
+
+            if (gEnableRsTbaa) {
+              InputLoad->setMetadata("tbaa", TBAAAllocation);
+            }
+
+            InputLoad->setMetadata("alias.scope", AliasingScope);
+
+            Input = InputLoad;
+          }
+
+          RootArgs.push_back(Input);
+        }
       }
+
+      finishArgList(RootArgs, CalleeArgs, CalleeArgsContextIdx, *Function, Builder);
+
+      llvm::Value *RetVal = Builder.CreateCall(Function, RootArgs);
+
+      if (OutPtr && !PassOutByPointer) {
+        llvm::StoreInst *Store = Builder.CreateStore(RetVal, OutPtr);
+        if (gEnableRsTbaa) {
+          Store->setMetadata("tbaa", TBAAAllocation);
+        }
+        Store->setMetadata("alias.scope", AliasingScope);
+      }
+    };
+
+    // Only cells passed by value can be widened; the others go through
+    // pointers or stack temporaries.
+    unsigned Width = 1;
+    llvm::SmallVector<llvm::Type*, 8> CellTypes;
+    bool CellsByValue = !PassOutByPointer;
+    for (size_t Index = 0; Index < NumInputs; ++Index) {
+      CellsByValue &= (InStructTempSlots[Index] == nullptr);
+      CellTypes.push_back(InTypes[Index]->getPointerElementType());
+    }
+    if (OutTy) {
+      CellTypes.push_back(OutTy->getPointerElementType());
+    }
+    if (CellsByValue) {
+      Width = getKernelLoopWidth(DL, Function, CellTypes);
     }
 
-    // Inputs
+    // Emits the loops over the cells x1 to x2 of one row.
+    auto ExpandRow = [&](llvm::Value *Y, llvm::Value *Z,
+                         llvm::Value *OutRowBase,
+                         llvm::ArrayRef<llvm::Value*> InRowBases) {
+      // Main loop: Width cells per iteration, up to the last multiple of
+      // Width.
+      llvm::Value *RemainderStart = Arg_x1;
+      if (Width > 1) {
+        llvm::Value *WideCount = Builder.CreateAnd(
+            Builder.CreateSub(Arg_x2, Arg_x1), ~(Width - 1));
+        RemainderStart = Builder.CreateAdd(Arg_x1, WideCount, "remainder_start");
+
+        llvm::PHINode *WideIV;
+        llvm::BasicBlock *AfterWide =
+            createLoop(Builder, Arg_x1, RemainderStart, &WideIV, Width);
+        for (unsigned Cell = 0; Cell < Width; ++Cell) {
+          ExpandCell(Cell ? Builder.CreateNUWAdd(WideIV, Builder.getInt32(Cell))
+                          : WideIV,
+                     Y, Z, OutRowBase, InRowBases);
+        }
+        Builder.SetInsertPoint(AfterWide, AfterWide->begin());
+      }
 
-    if (NumInputs > 0) {
-      llvm::Value *Offset = Builder.CreateSub(IV, Arg_x1);
+      // Remainder loop (or the only loop): one cell per iteration.
+      llvm::PHINode *IV;
+      createLoop(Builder, RemainderStart, Arg_x2, &IV);
+      ExpandCell(IV, Y, Z, OutRowBase, InRowBases);
+    };
+
+    if (!Tile) {
+      ExpandRow(nullptr, nullptr, CastedOutBasePtr, InBasePtrs);
+      return true;
+    }
 
-      for (size_t Index = 0; Index < NumInputs; ++Index) {
-        llvm::Value *InPtr    = Builder.CreateGEP(InBasePtrs[Index], Offset);
-        llvm::Value *Input;
+    // The base pointers point at the first cell of the tile; the strides
+    // (in bytes) lead to the first cell of the other rows and slices.
+    llvm::Value *OutRowStride = nullptr, *OutSliceStride = nullptr;
+    if (CastedOutBasePtr) {
+      OutRowStride = loadTileField(RsExpandTileFieldOutRowStride,
+                                   "out_row_stride");
+      OutSliceStride = loadTileField(RsExpandTileFieldOutSliceStride,
+                                     "out_slice_stride");
+    }
 
-        if (llvm::Value *TemporarySlot = InStructTempSlots[Index]) {
-          // Pass a pointer to a temporary on the stack, rather than
-          // passing a pointer to the original value. We do not want
-          // the kernel to potentially modify the input data.
+    llvm::SmallVector<llvm::Value*, 8> InRowStrides, InSliceStrides;
+    for (size_t Index = 0; Index < NumInputs; ++Index) {
+      InRowStrides.push_back(Builder.CreateLoad(
+          Builder.CreateConstInBoundsGEP2_32(nullptr,
+              Builder.CreateStructGEP(nullptr, Arg_tile, RsExpandTileFieldInRowStride),
+              0, Index), "in_row_stride"));
+      InSliceStrides.push_back(Builder.CreateLoad(
+          Builder.CreateConstInBoundsGEP2_32(nullptr,
+              Builder.CreateStructGEP(nullptr, Arg_tile, RsExpandTileFieldInSliceStride),
+              0, Index), "in_slice_stride"));
+    }
 
-          llvm::Type *ElementType = llvm::cast<llvm::PointerType>(
-                                        InPtr->getType())->getElementType();
-          uint64_t StoreSize = DL.getTypeStoreSize(ElementType);
-          uint64_t Alignment = DL.getABITypeAlignment(ElementType);
+    llvm::PHINode *IVz, *IVy;
+    createLoop(Builder, Tile_z1, Tile_z2, &IVz);
+    createLoop(Builder, Tile_y1, Tile_y2, &IVy);
+
+    llvm::Value *RowIndex = Builder.CreateSub(IVy, Tile_y1);
+    llvm::Value *SliceIndex = Builder.CreateSub(IVz, Tile_z1);
+    llvm::Type *IntPtrTy = DL.getIntPtrType(*Context);
+    llvm::Type *Int8PtrTy = llvm::Type::getInt8PtrTy(*Context);
+
+    auto RowBase = [&](llvm::Value *Base, llvm::Value *RowStride,
+                       llvm::Value *SliceStride) {
+      llvm::Value *Offset = Builder.CreateAdd(
+          Builder.CreateMul(RowIndex, RowStride),
+          Builder.CreateMul(SliceIndex, SliceStride));
+      llvm::Value *Row = Builder.CreateInBoundsGEP(
+          Builder.CreatePointerCast(Base, Int8PtrTy),
+          Builder.CreateZExt(Offset, IntPtrTy));
+      return Builder.CreatePointerCast(Row, Base->getType());
+    };
+
+    llvm::Value *OutRowBase = nullptr;
+    if (CastedOutBasePtr) {
+      OutRowBase = RowBase(CastedOutBasePtr, OutRowStride, OutSliceStride);
+    }
 
-          Builder.CreateMemCpy(TemporarySlot, InPtr, StoreSize, Alignment,
-                               /* isVolatile = */ false,
-                               /* !tbaa = */ gEnableRsTbaa ? TBAAAllocation : nullptr,
-                               /* !tbaa.struct = */ nullptr,
-                               /* !alias.scope = */ AliasingScope);
-          Input = TemporarySlot;
-        } else {
-          llvm::LoadInst *InputLoad = Builder.CreateLoad(InPtr, "input");
+    llvm::SmallVector<llvm::Value*, 8> InRowBases;
+    for (size_t Index = 0; Index < NumInputs; ++Index) {
+      InRowBases.push_back(RowBase(InBasePtrs[Index], InRowStrides[Index],
+                                   InSliceStrides[Index]));
+    }
 
-          if (gEnableRsTbaa) {
-            InputLoad->setMetadata("tbaa", TBAAAllocation);
-          }
+    ExpandRow(IVy, IVz, OutRowBase, InRowBases);
+
+    return true;
+  }
+
+  // Returns true if the signature of a reduction accumulator has any special
+  // arguments.
+  static bool hasReduceSpecialArguments(uint32_t Signature) {
+    return bcinfo::MetadataExtractor::hasForEachSignatureCtxt(Signature) ||
+           bcinfo::MetadataExtractor::hasForEachSignatureX(Signature) ||
+           bcinfo::MetadataExtractor::hasForEachSignatureY(Signature) ||
+           bcinfo::MetadataExtractor::hasForEachSignatureZ(Signature);
+  }
+
+  /* Expands the accumulator function of a reduction kernel. On success, the
+   * Module will contain a new function "<ACCUMULATOR>.expand" that calls
+   *
+   *   accumulator(accum, in1[X], ..., inN[X], <special arguments>)
+   *
+   * for each X in [x1, x2), folding the row into the accumulator data of the
+   * calling thread (see RSExpandReduce.h). The runtime allocates
+   * AccumulatorDataSize bytes of accumulator data per thread.
+   */
+  bool ExpandReduceAccumulator(llvm::Function *FnAccumulator,
+                               uint32_t Signature, size_t NumInputs,
+                               uint32_t AccumulatorDataSize) {
+    ALOGV("Expanding accumulator Function %s",
+          FnAccumulator->getName().str().c_str());
+
+    if (FnAccumulator->arg_size() < NumInputs + 1 ||
+        !FnAccumulator->arg_begin()->getType()->isPointerTy() ||
+        !FnAccumulator->getReturnType()->isVoidTy()) {
+      ALOGE("Accumulator %s has an unexpected signature",
+            FnAccumulator->getName().str().c_str());
+      return false;
+    }
+
+    if (NumInputs > RS_KERNEL_INPUT_LIMIT) {
+      ALOGE("Accumulator %s has %zu inputs; at most %zu are supported",
+            FnAccumulator->getName().str().c_str(), NumInputs,
+            static_cast<size_t>(RS_KERNEL_INPUT_LIMIT));
+      return false;
+    }
+
+    llvm::DataLayout DL(Module);
+
+    // The accumulator must not reach past the data the runtime allocated.
+    llvm::Type *AccumTy = llvm::cast<llvm::PointerType>(
+        FnAccumulator->arg_begin()->getType())->getElementType();
+    if (!AccumTy->isSized() ||
+        DL.getTypeAllocSize(AccumTy) > AccumulatorDataSize) {
+      ALOGE("Accumulator %s accesses more than the %u bytes of its "
+            "accumulator data", FnAccumulator->getName().str().c_str(),
+            AccumulatorDataSize);
+      return false;
+    }
+
+    llvm::Function *ExpandedFunction =
+      createEmptyExpandedAccumulator(FnAccumulator->getName());
+
+    llvm::Function::arg_iterator ExpandedFunctionArgIter =
+      ExpandedFunction->arg_begin();
+
+    llvm::Value *Arg_p     = &*(ExpandedFunctionArgIter++);
+    llvm::Value *Arg_x1    = &*(ExpandedFunctionArgIter++);
+    llvm::Value *Arg_x2    = &*(ExpandedFunctionArgIter++);
+    llvm::Value *Arg_accum = &*(ExpandedFunctionArgIter++);
+
+    // Construct the actual function body.
+    llvm::IRBuilder<> Builder(ExpandedFunction->getEntryBlock().begin());
+
+    llvm::Function::arg_iterator ArgIter = FnAccumulator->arg_begin();
 
-          InputLoad->setMetadata("alias.scope", AliasingScope);
+    llvm::Value *CastedAccum =
+      Builder.CreatePointerCast(Arg_accum, (ArgIter++)->getType(),
+                                "casted_accum");
 
-          Input = InputLoad;
+    // Load the input base pointers before entering the loop. As in
+    // ExpandKernel(), pointer parameters are struct inputs passed by
+    // reference and get a temporary copy on the stack.
+    llvm::SmallVector<llvm::Value*, 8> InBasePtrs;
+    llvm::SmallVector<llvm::Value*, 8> InStructTempSlots;
+
+    if (NumInputs > 0) {
+      llvm::Value *InsBasePtr = Builder.CreateStructGEP(nullptr, Arg_p, RsExpandKernelDriverInfoPfxFieldInPtr, "inputs_base");
+
+      llvm::Instruction *AllocaInsertionPoint = &*ExpandedFunction->getEntryBlock().begin();
+      for (size_t InputIndex = 0; InputIndex < NumInputs;
+           ++InputIndex, ArgIter++) {
+        llvm::Type *InType = ArgIter->getType();
+
+        if (auto PtrType = llvm::dyn_cast<llvm::PointerType>(InType)) {
+          llvm::Type *ElementType = PtrType->getElementType();
+          uint64_t Alignment = DL.getABITypeAlignment(ElementType);
+          llvm::Value *Slot = new llvm::AllocaInst(ElementType,
+                                                   nullptr,
+                                                   Alignment,
+                                                   "input_struct_slot",
+                                                   AllocaInsertionPoint);
+          InStructTempSlots.push_back(Slot);
+        } else {
+          InType = InType->getPointerTo();
+          InStructTempSlots.push_back(nullptr);
         }
 
-        RootArgs.push_back(Input);
+        llvm::Value *InputAddr = Builder.CreateConstInBoundsGEP2_32(nullptr, InsBasePtr, 0, InputIndex);
+        llvm::LoadInst *InBasePtr = Builder.CreateLoad(InputAddr,
+                                                       "input_base");
+        InBasePtrs.push_back(Builder.CreatePointerCast(InBasePtr, InType,
+                                                       "casted_in"));
       }
     }
 
-    finishArgList(RootArgs, CalleeArgs, CalleeArgsContextIdx, *Function, Builder);
-
-    llvm::Value *RetVal = Builder.CreateCall(Function, RootArgs);
+    llvm::PHINode *IV;
+    createLoop(Builder, Arg_x1, Arg_x2, &IV);
 
-    if (OutPtr && !PassOutByPointer) {
-      llvm::StoreInst *Store = Builder.CreateStore(RetVal, OutPtr);
-      if (gEnableRsTbaa) {
-        Store->setMetadata("tbaa", TBAAAllocation);
+    llvm::SmallVector<llvm::Value*, 8> CalleeArgs;
+    const int CalleeArgsContextIdx = ExpandSpecialArguments(Signature, IV, Arg_p, Builder, CalleeArgs,
+                                                            []() { });
+
+    llvm::SmallVector<llvm::Value*, 8> AccumulatorArgs;
+    AccumulatorArgs.push_back(CastedAccum);
+
+    llvm::Value *Offset = Builder.CreateSub(IV, Arg_x1);
+    for (size_t Index = 0; Index < NumInputs; ++Index) {
+      llvm::Value *InPtr = Builder.CreateGEP(InBasePtrs[Index], Offset);
+
+      if (llvm::Value *TemporarySlot = InStructTempSlots[Index]) {
+        llvm::Type *ElementType = llvm::cast<llvm::PointerType>(
+                                      InPtr->getType())->getElementType();
+        Builder.CreateMemCpy(TemporarySlot, InPtr,
+                             DL.getTypeStoreSize(ElementType),
+                             DL.getABITypeAlignment(ElementType));
+        AccumulatorArgs.push_back(TemporarySlot);
+      } else {
+        AccumulatorArgs.push_back(Builder.CreateLoad(InPtr, "input"));
       }
-      Store->setMetadata("alias.scope", AliasingScope);
     }
 
+    finishArgList(AccumulatorArgs, CalleeArgs, CalleeArgsContextIdx,
+                  *FnAccumulator, Builder);
+
+    Builder.CreateCall(FnAccumulator, AccumulatorArgs);
+
+    return true;
+  }
+
+  /* Generates "<ACCUMULATOR>.combiner" for a reduction kernel that does not
+   * give a combiner function:
+   *
+   *   void combiner(AccumType *accum, const AccumType *other) {
+   *     accumulator(accum, *other);
+   *   }
+   *
+   * This is only correct if the accumulator takes a single input of the
+   * accumulator type and no special arguments; returns false otherwise.
+   */
+  bool CreateReduceCombinerFromAccumulator(llvm::Function *FnAccumulator,
+                                           uint32_t Signature,
+                                           size_t NumInputs) {
+    if (NumInputs != 1 || hasReduceSpecialArguments(Signature) ||
+        FnAccumulator->arg_size() != 2) {
+      return false;
+    }
+
+    llvm::Function::arg_iterator ArgIter = FnAccumulator->arg_begin();
+    llvm::Type *AccumPtrTy = (ArgIter++)->getType();
+    llvm::Type *AccumTy = AccumPtrTy->getPointerElementType();
+    llvm::Type *InType = ArgIter->getType();
+
+    // The input is either passed by value or, for structs, by reference.
+    bool InputByReference = (InType == AccumPtrTy);
+    if (!InputByReference && InType != AccumTy) {
+      return false;
+    }
+
+    llvm::DataLayout DL(Module);
+
+    llvm::Type *ParamTypes[] = { AccumPtrTy, AccumPtrTy };
+    llvm::Function *Combiner =
+      llvm::Function::Create(llvm::FunctionType::get(
+                                 llvm::Type::getVoidTy(*Context), ParamTypes,
+                                 false),
+                             llvm::GlobalValue::ExternalLinkage,
+                             FnAccumulator->getName() +
+                                 bcc::kRsReduceCombinerSuffix,
+                             Module);
+
+    llvm::Function::arg_iterator AI = Combiner->arg_begin();
+    llvm::Value *Arg_accum = &*(AI++);
+    llvm::Value *Arg_other = &*(AI++);
+    Arg_accum->setName("accum");
+    Arg_other->setName("other");
+
+    llvm::BasicBlock *Begin = llvm::BasicBlock::Create(*Context, "Begin",
+                                                       Combiner);
+    llvm::IRBuilder<> Builder(Begin);
+
+    llvm::Value *Input = nullptr;
+    if (InputByReference) {
+      // Do not let the accumulator modify *other.
+      uint64_t Alignment = DL.getABITypeAlignment(AccumTy);
+      Input = Builder.CreateAlloca(AccumTy, nullptr, "other_slot");
+      llvm::cast<llvm::AllocaInst>(Input)->setAlignment(Alignment);
+      Builder.CreateMemCpy(Input, Arg_other, DL.getTypeStoreSize(AccumTy),
+                           Alignment);
+    } else {
+      Input = Builder.CreateLoad(Arg_other, "other_value");
+    }
+
+    Builder.CreateCall(FnAccumulator, {Arg_accum, Input});
+    Builder.CreateRetVoid();
+
     return true;
   }
 
@@ -911,44 +1680,52 @@ public:
   /// pointers.
   bool allocPointersExposed(llvm::Module &Module) {
     // Old style kernel function can expose pointers to elements within
-    // allocations.
-    // TODO: Extend analysis to allow simple cases of old-style kernels.
+    // allocations, unless they only access their current cells through them
+    // (see collectLegacyCellAccesses()).
     for (size_t i = 0; i < mExportForEachCount; ++i) {
       const char *Name = mExportForEachNameList[i];
       uint32_t Signature = mExportForEachSignatureList[i];
-      if (Module.getFunction(Name) &&
+      llvm::Function *Function = Module.getFunction(Name);
+      if (Function &&
           !bcinfo::MetadataExtractor::hasForEachSignatureKernel(Signature)) {
-        return true;
+        if (!Signature) {
+          Signature = getRootSignature(Function);
+        }
+        if (!Signature ||
+            !collectLegacyCellAccesses(Function, Signature, nullptr)) {
+          return true;
+        }
       }
     }
 
     // Check for library functions that expose a pointer to an Allocation or
     // that are not yet annotated with RenderScript-specific tbaa information.
-    static std::vector<std::string> Funcs;
-
-    // rsGetElementAt(...)
-    Funcs.push_back("_Z14rsGetElementAt13rs_allocationj");
-    Funcs.push_back("_Z14rsGetElementAt13rs_allocationjj");
-    Funcs.push_back("_Z14rsGetElementAt13rs_allocationjjj");
-    // rsSetElementAt()
-    Funcs.push_back("_Z14rsSetElementAt13rs_allocationPvj");
-    Funcs.push_back("_Z14rsSetElementAt13rs_allocationPvjj");
-    Funcs.push_back("_Z14rsSetElementAt13rs_allocationPvjjj");
-    // rsGetElementAtYuv_uchar_Y()
-    Funcs.push_back("_Z25rsGetElementAtYuv_uchar_Y13rs_allocationjj");
-    // rsGetElementAtYuv_uchar_U()
-    Funcs.push_back("_Z25rsGetElementAtYuv_uchar_U13rs_allocationjj");
-    // rsGetElementAtYuv_uchar_V()
-    Funcs.push_back("_Z25rsGetElementAtYuv_uchar_V13rs_allocationjj");
-
-    for (std::vector<std::string>::iterator FI = Funcs.begin(),
-                                            FE = Funcs.end();
-         FI != FE; ++FI) {
-      llvm::Function *Function = Module.getFunction(*FI);
-
+    // Note: this list is read-only so that several compilations may run on
+    // different threads.
+    static const char *const Funcs[] = {
+      // rsGetElementAt(...)
+      "_Z14rsGetElementAt13rs_allocationj",
+      "_Z14rsGetElementAt13rs_allocationjj",
+      "_Z14rsGetElementAt13rs_allocationjjj",
+      // rsSetElementAt()
+      "_Z14rsSetElementAt13rs_allocationPvj",
+      "_Z14rsSetElementAt13rs_allocationPvjj",
+      "_Z14rsSetElementAt13rs_allocationPvjjj",
+      // rsGetElementAtYuv_uchar_Y()
+      "_Z25rsGetElementAtYuv_uchar_Y13rs_allocationjj",
+      // rsGetElementAtYuv_uchar_U()
+      "_Z25rsGetElementAtYuv_uchar_U13rs_allocationjj",
+      // rsGetElementAtYuv_uchar_V()
+      "_Z25rsGetElementAtYuv_uchar_V13rs_allocationjj",
+    };
+
+    for (const char *FuncName : Funcs) {
+      llvm::Function *Function = Module.getFunction(FuncName);
+
+      // With selective runtime import, functions the script does not use are
+      // not linked in at all.
       if (!Function) {
-        ALOGE("Missing run-time function '%s'", FI->c_str());
-        return true;
+        continue;
       }
 
       if (Function->getNumUses() > 0) {
@@ -986,16 +1763,24 @@ public:
 
     this->buildTypes();
 
-    bcinfo::MetadataExtractor me(&Module);
-    if (!me.extract()) {
-      ALOGE("Could not extract metadata from module!");
-      return false;
+    std::unique_ptr<bcinfo::MetadataExtractor> ExtractedMetadata;
+    const bcinfo::MetadataExtractor *me = mMetadata;
+    if (me == nullptr) {
+      ExtractedMetadata.reset(new bcinfo::MetadataExtractor(&Module));
+      if (!ExtractedMetadata->extract()) {
+        ALOGE("Could not extract metadata from module!");
+        return false;
+      }
+      me = ExtractedMetadata.get();
     }
-    mExportForEachCount = me.getExportForEachSignatureCount();
-    mExportForEachNameList = me.getExportForEachNameList();
-    mExportForEachSignatureList = me.getExportForEachSignatureList();
+    mExportForEachCount = me->getExportForEachSignatureCount();
+    mExportForEachNameList = me->getExportForEachNameList();
+    mExportForEachSignatureList = me->getExportForEachSignatureList();
+    mExportReduceCount = me->getExportReduceCount();
+    mExportReduceList = me->getExportReduceList();
 
     bool AllocsExposed = allocPointersExposed(Module);
+    bool ExpandedTiles = false;
 
     for (size_t i = 0; i < mExportForEachCount; ++i) {
       const char *name = mExportForEachNameList[i];
@@ -1004,6 +1789,10 @@ public:
       if (kernel) {
         if (bcinfo::MetadataExtractor::hasForEachSignatureKernel(signature)) {
           Changed |= ExpandKernel(kernel, signature);
+          if (mExpandTiles) {
+            Changed |= ExpandKernel(kernel, signature, /* Tile */true);
+            ExpandedTiles = true;
+          }
           kernel->setLinkage(llvm::GlobalValue::InternalLinkage);
         } else if (kernel->getReturnType()->isVoidTy()) {
           Changed |= ExpandFunction(kernel, signature);
@@ -1016,10 +1805,46 @@ public:
       }
     }
 
+    for (size_t i = 0; i < mExportReduceCount; ++i) {
+      const bcinfo::MetadataExtractor::Reduce &Reduce = mExportReduceList[i];
+      llvm::Function *FnAccumulator =
+          Module.getFunction(Reduce.mAccumulatorName);
+      if (!FnAccumulator) {
+        continue;
+      }
+
+      if (ExpandReduceAccumulator(FnAccumulator, Reduce.mSignature,
+                                  Reduce.mInputCount,
+                                  Reduce.mAccumulatorDataSize)) {
+        Changed = true;
+        if (!Reduce.mCombinerName) {
+          if (CreateReduceCombinerFromAccumulator(FnAccumulator,
+                                                  Reduce.mSignature,
+                                                  Reduce.mInputCount)) {
+            Changed = true;
+          } else {
+            ALOGV("No combiner for reduce %s; it will run serially",
+                  Reduce.mReduceName);
+          }
+        }
+        FnAccumulator->setLinkage(llvm::GlobalValue::InternalLinkage);
+      }
+    }
+
     if (gEnableRsTbaa && !AllocsExposed) {
       connectRenderScriptTBAAMetadata(Module);
     }
 
+    // Advertise the tiled variants and the layout of RsExpandTile they use.
+    if (ExpandedTiles) {
+      llvm::Type *Int32Ty = llvm::Type::getInt32Ty(*Context);
+      new llvm::GlobalVariable(Module, Int32Ty, /* isConstant */true,
+                               llvm::GlobalValue::ExternalLinkage,
+                               llvm::ConstantInt::get(Int32Ty,
+                                                      RS_EXPAND_TILE_VERSION),
+                               kRsExpandTileVersion);
+    }
+
     return Changed;
   }
 
@@ -1037,8 +1862,11 @@ static llvm::RegisterPass<RSForEachExpandPass> X("foreachexp", "ForEach Expand P
 namespace bcc {
 
 llvm::ModulePass *
-createRSForEachExpandPass(bool pEnableStepOpt){
-  return new RSForEachExpandPass(pEnableStepOpt);
+createRSForEachExpandPass(bool pEnableStepOpt,
+                          const bcinfo::MetadataExtractor *pMetadata,
+                          bool pWidenKernelLoops, bool pExpandTiles){
+  return new RSForEachExpandPass(pEnableStepOpt, pMetadata, pWidenKernelLoops,
+                                 pExpandTiles);
 }
 
 } // end namespace bcc
@@ -258,6 +258,10 @@ public:
     // Upon completion, this pass has always modified the Module.
     return true;
   }
+
+  virtual const char *getPassName() const override {
+    return "Embed Renderscript Global Info";
+  }
 };
 
 }
@@ -119,6 +119,10 @@ public:
     return false;
   }
 
+  virtual const char *getPassName() const override {
+    return "Check Renderscript Threadability";
+  }
+
 };
 
 }
@@ -0,0 +1,287 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSMultiVersion.h"
+#include "bcc/Renderscript/RSTransforms.h"
+#include "bcc/Support/Log.h"
+
+#include "bcinfo/MetadataExtractor.h"
+
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace bcc;
+
+const char bcc::kRsExpandResolve[] = ".rs.expand_resolve";
+
+namespace {
+
+// A CPU variant the .expand functions are cloned for. mFeatures is appended
+// to the feature string of the target machine: a "target-features" function
+// attribute replaces that string instead of adding to it. Variants with
+// mRelaxedOnly set are not IEEE 754 compliant and are only used for scripts
+// that allow relaxed floating point.
+struct KernelVariant {
+  const char *mSuffix;
+  const char *mFeatures;
+  uint32_t mCPUFeatures;
+  bool mRelaxedOnly;
+};
+
+// The variants of each architecture, from the most to the least preferred.
+//
+// NEON flushes denormals, which is why CompilerConfig builds full-precision
+// scripts with -neon,-neonfp; they get no ARM variant. Relaxed scripts already
+// have NEON in their baseline wherever the device has it, so for them the
+// variant adds the half-precision conversions and all 32 D registers.
+const KernelVariant kARMVariants[] = {
+  { "neon", "+neon,+fp16,-d16", kRsCPUNeonFP16, true },
+};
+
+const KernelVariant kX86Variants[] = {
+  { "avx2", "+avx2,+fma", kRsCPUAVX2, false },
+  { "sse42", "+sse4.2,+popcnt", kRsCPUSSE42, false },
+};
+
+/* RSMultiVersionPass: Clones every .expand function, of the forEach kernels
+ * (tiled or not) and of the reduction accumulators alike, once per CPU
+ * variant of the target architecture (plus once for the baseline) and turns
+ * the .expand functions into thunks that jump through a pointer to the
+ * selected clone.
+ * It also emits the resolver that selects the clones (see RSMultiVersion.h).
+ *
+ * The runtime looks up and calls the .expand functions by name, so it needs
+ * no change beyond calling the resolver. The thunk costs one indirect call
+ * per call of a .expand function, which covers a whole slice of the launch.
+ */
+class RSMultiVersionPass : public llvm::ModulePass {
+private:
+  llvm::Triple::ArchType mArch;
+  std::string mBaseFeatures;
+  bool mFullPrecision;
+
+  struct Kernel {
+    llvm::Function *mBaseline;
+    std::vector<llvm::Function *> mVariants;
+    llvm::GlobalVariable *mImpl;
+  };
+
+  static llvm::Function *cloneKernel(llvm::Module &M, llvm::Function *F,
+                                     const llvm::Twine &Name) {
+    llvm::ValueToValueMapTy VMap;
+    llvm::Function *Clone = llvm::CloneFunction(F, VMap,
+                                                /* ModuleLevelChanges */false);
+    M.getFunctionList().push_back(Clone);
+    Clone->setName(Name);
+    Clone->setLinkage(llvm::GlobalValue::InternalLinkage);
+    return Clone;
+  }
+
+  // Replace the body of F with a tail call through Impl.
+  static void makeThunk(llvm::Function *F, llvm::GlobalVariable *Impl) {
+    F->deleteBody();
+
+    llvm::BasicBlock *Entry =
+        llvm::BasicBlock::Create(F->getContext(), "entry", F);
+    llvm::IRBuilder<> Builder(Entry);
+
+    std::vector<llvm::Value *> Args;
+    for (llvm::Argument &Arg : F->args()) {
+      Args.push_back(&Arg);
+    }
+
+    llvm::CallInst *Call = Builder.CreateCall(Builder.CreateLoad(Impl), Args);
+    Call->setCallingConv(F->getCallingConv());
+    Call->setAttributes(F->getAttributes());
+    Call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+
+    if (F->getReturnType()->isVoidTy()) {
+      Builder.CreateRetVoid();
+    } else {
+      Builder.CreateRet(Call);
+    }
+  }
+
+  // Emit the resolver, which points every kernel at its clone for the most
+  // preferred variant the CPU supports, or at its baseline clone.
+  static void
+  createResolver(llvm::Module &M, const std::vector<Kernel> &Kernels,
+                 const std::vector<const KernelVariant *> &Variants) {
+    const size_t NumVariants = Variants.size();
+    llvm::LLVMContext &Context = M.getContext();
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(Context);
+    llvm::FunctionType *ResolverTy = llvm::FunctionType::get(
+        llvm::Type::getVoidTy(Context), Int32Ty, /* isVarArg */false);
+    llvm::Function *Resolver = llvm::Function::Create(
+        ResolverTy, llvm::GlobalValue::ExternalLinkage, kRsExpandResolve, &M);
+    Resolver->addFnAttr(llvm::Attribute::NoUnwind);
+    llvm::Value *CPUFeatures = &*Resolver->arg_begin();
+    CPUFeatures->setName("cpu_features");
+
+    llvm::BasicBlock *Check =
+        llvm::BasicBlock::Create(Context, "entry", Resolver);
+    for (size_t i = 0; i <= NumVariants; i++) {
+      llvm::BasicBlock *Select =
+          llvm::BasicBlock::Create(Context, "select", Resolver);
+      llvm::IRBuilder<> Builder(Select);
+      for (const Kernel &K : Kernels) {
+        Builder.CreateStore((i < NumVariants) ? K.mVariants[i] : K.mBaseline,
+                            K.mImpl);
+      }
+      Builder.CreateRetVoid();
+
+      Builder.SetInsertPoint(Check);
+      if (i == NumVariants) {
+        Builder.CreateBr(Select);
+        break;
+      }
+
+      llvm::BasicBlock *Next =
+          llvm::BasicBlock::Create(Context, "check", Resolver);
+      llvm::Value *Mask = Builder.getInt32(Variants[i]->mCPUFeatures);
+      llvm::Value *Supported =
+          Builder.CreateICmpEQ(Builder.CreateAnd(CPUFeatures, Mask), Mask);
+      Builder.CreateCondBr(Supported, Select, Next);
+      Check = Next;
+    }
+  }
+
+public:
+  static char ID;
+
+  RSMultiVersionPass(const std::string &pTriple,
+                     const std::string &pBaseFeatures,
+                     bool pFullPrecision)
+    : ModulePass(ID), mArch(llvm::Triple(pTriple).getArch()),
+      mBaseFeatures(pBaseFeatures), mFullPrecision(pFullPrecision) { }
+
+  bool runOnModule(llvm::Module &M) override {
+    const KernelVariant *ArchVariants = nullptr;
+    size_t NumArchVariants = 0;
+    switch (mArch) {
+    case llvm::Triple::arm:
+    case llvm::Triple::thumb:
+      ArchVariants = kARMVariants;
+      NumArchVariants = sizeof(kARMVariants) / sizeof(kARMVariants[0]);
+      break;
+    case llvm::Triple::x86:
+    case llvm::Triple::x86_64:
+      ArchVariants = kX86Variants;
+      NumArchVariants = sizeof(kX86Variants) / sizeof(kX86Variants[0]);
+      break;
+    default:
+      return false;
+    }
+
+    std::vector<const KernelVariant *> Variants;
+    for (size_t v = 0; v < NumArchVariants; v++) {
+      if (!mFullPrecision || !ArchVariants[v].mRelaxedOnly) {
+        Variants.push_back(&ArchVariants[v]);
+      }
+    }
+    if (Variants.empty()) {
+      return false;
+    }
+
+    bcinfo::MetadataExtractor me(&M);
+    if (!me.extract()) {
+      ALOGE("Could not extract metadata from module!");
+      return false;
+    }
+
+    // The expanded kernels, their tiled variants (see RSExpandTile.h), which
+    // the runtime prefers where they exist, and the expanded reduction
+    // accumulators.
+    std::vector<std::string> Names;
+    for (size_t i = 0; i < me.getExportForEachSignatureCount(); i++) {
+      std::string Name(me.getExportForEachNameList()[i]);
+      Names.push_back(Name + ".expand");
+      Names.push_back(Name + ".expand.tile");
+    }
+    for (size_t i = 0; i < me.getExportReduceCount(); i++) {
+      Names.push_back(
+          std::string(me.getExportReduceList()[i].mAccumulatorName) +
+          ".expand");
+    }
+
+    std::vector<Kernel> Kernels;
+    for (const std::string &Name : Names) {
+      llvm::Function *F = M.getFunction(Name);
+      if ((F == nullptr) || F->isDeclaration() || F->isVarArg()) {
+        continue;
+      }
+
+      Kernel K;
+      K.mBaseline = cloneKernel(M, F, Name + ".baseline");
+      for (const KernelVariant *Variant : Variants) {
+        llvm::Function *Clone =
+            cloneKernel(M, F, Name + "." + Variant->mSuffix);
+        std::string Features = mBaseFeatures;
+        if (!Features.empty()) {
+          Features += ",";
+        }
+        Features += Variant->mFeatures;
+        Clone->addFnAttr("target-features", Features);
+        K.mVariants.push_back(Clone);
+      }
+
+      // Until the resolver is called, the thunk runs the baseline clone.
+      K.mImpl = new llvm::GlobalVariable(M, F->getType(),
+                                         /* isConstant */false,
+                                         llvm::GlobalValue::InternalLinkage,
+                                         K.mBaseline, Name + ".impl");
+      makeThunk(F, K.mImpl);
+      Kernels.push_back(K);
+    }
+
+    if (Kernels.empty()) {
+      return false;
+    }
+
+    createResolver(M, Kernels, Variants);
+    return true;
+  }
+
+  virtual const char *getPassName() const override {
+    return "Multiversion Renderscript Kernels";
+  }
+};
+
+} // end anonymous namespace
+
+char RSMultiVersionPass::ID = 0;
+
+namespace bcc {
+
+llvm::ModulePass *
+createRSMultiVersionPass(const std::string &pTriple,
+                         const std::string &pBaseFeatures,
+                         bool pFullPrecision) {
+  return new RSMultiVersionPass(pTriple, pBaseFeatures, pFullPrecision);
+}
+
+} // end namespace bcc
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSProfile.h"
+
+#include "bcc/Support/AtomicOutputFile.h"
+#include "bcc/Support/Log.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <memory>
+
+namespace bcc {
+
+const char kRsProfChecksum[] = ".rs.prof_checksum";
+const char kRsProfEntries[] = ".rs.prof_entries";
+const char kRsProfNames[] = ".rs.prof_names";
+const char kRsProfCounters[] = ".rs.prof_counters";
+const char kRsProfSizes[] = ".rs.prof_sizes";
+
+} // end namespace bcc
+
+using namespace bcc;
+
+namespace {
+
+const char kProfileMagic[] = "rs-profile 1";
+
+} // end anonymous namespace
+
+const std::vector<uint64_t> *
+RSProfile::getCounters(const std::string &pFunction) const {
+  CounterMap::const_iterator I = mCounters.find(pFunction);
+  return (I != mCounters.end()) ? &I->second : nullptr;
+}
+
+bool RSProfile::addCounters(const std::string &pFunction,
+                            const std::vector<uint64_t> &pCounters) {
+  std::vector<uint64_t> &counters = mCounters[pFunction];
+  if (counters.empty()) {
+    counters = pCounters;
+    return true;
+  }
+
+  if (counters.size() != pCounters.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < counters.size(); i++) {
+    counters[i] += pCounters[i];
+  }
+  return true;
+}
+
+bool RSProfile::collect(RSProfileSymbolLookup pLookup, void *pContext) {
+  const char *const *checksum =
+      static_cast<const char *const *>(pLookup(pContext, kRsProfChecksum));
+  const uint32_t *entries =
+      static_cast<const uint32_t *>(pLookup(pContext, kRsProfEntries));
+  const char *const *names =
+      static_cast<const char *const *>(pLookup(pContext, kRsProfNames));
+  uint64_t *const *counters =
+      static_cast<uint64_t *const *>(pLookup(pContext, kRsProfCounters));
+  const uint32_t *sizes =
+      static_cast<const uint32_t *>(pLookup(pContext, kRsProfSizes));
+
+  if ((checksum == nullptr) || (entries == nullptr) || (names == nullptr) ||
+      (counters == nullptr) || (sizes == nullptr)) {
+    ALOGE("Script has no profile counters!");
+    return false;
+  }
+
+  if (mCounters.empty()) {
+    mBuildChecksum = *checksum;
+  } else if (mBuildChecksum != *checksum) {
+    ALOGE("Not adding counters of build %s to the profile of build %s!",
+          *checksum, mBuildChecksum.c_str());
+    return false;
+  }
+
+  for (uint32_t i = 0; i < *entries; i++) {
+    std::vector<uint64_t> function_counters(counters[i],
+                                            counters[i] + sizes[i]);
+    if (!addCounters(names[i], function_counters)) {
+      ALOGE("Counters of %s do not match the profile!", names[i]);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool RSProfile::read(const std::string &pPath) {
+  clear();
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer> > file =
+      llvm::MemoryBuffer::getFile(pPath);
+  if (!file) {
+    ALOGE("Unable to read profile %s! (%s)", pPath.c_str(),
+          file.getError().message().c_str());
+    return false;
+  }
+
+  llvm::SmallVector<llvm::StringRef, 16> lines;
+  (*file)->getBuffer().split(lines, "\n", -1, /* KeepEmpty */false);
+
+  if ((lines.size() < 2) || (lines[0].rtrim() != kProfileMagic) ||
+      !lines[1].startswith("checksum")) {
+    ALOGE("%s is not an RS profile!", pPath.c_str());
+    return false;
+  }
+  mBuildChecksum = lines[1].substr(sizeof("checksum") - 1).trim();
+
+  for (size_t i = 2; i < lines.size(); i += 2) {
+    llvm::SmallVector<llvm::StringRef, 3> header;
+    lines[i].split(header, " ", -1, /* KeepEmpty */false);
+
+    unsigned num_counters;
+    if ((header.size() != 3) || (header[0] != "function") ||
+        header[2].trim().getAsInteger(10, num_counters) ||
+        (i + 1 >= lines.size())) {
+      ALOGE("Malformed function entry in profile %s!", pPath.c_str());
+      clear();
+      return false;
+    }
+
+    llvm::SmallVector<llvm::StringRef, 16> values;
+    lines[i + 1].split(values, " ", -1, /* KeepEmpty */false);
+
+    std::vector<uint64_t> counters;
+    for (llvm::StringRef value : values) {
+      uint64_t counter;
+      if (value.trim().getAsInteger(10, counter)) {
+        break;
+      }
+      counters.push_back(counter);
+    }
+
+    if ((counters.size() != num_counters) ||
+        !addCounters(header[1], counters)) {
+      ALOGE("Malformed counters for %s in profile %s!",
+            header[1].str().c_str(), pPath.c_str());
+      clear();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool RSProfile::write(const std::string &pPath) const {
+  AtomicOutputFile output(pPath);
+  if (output.hasError()) {
+    ALOGE("Unable to open %s for write! (%s)", pPath.c_str(),
+          output.getErrorMessage().c_str());
+    return false;
+  }
+
+  llvm::raw_fd_ostream &os = output.getStream();
+  os << kProfileMagic << "\n";
+  os << "checksum " << mBuildChecksum << "\n";
+  for (const CounterMap::value_type &entry : mCounters) {
+    os << "function " << entry.first << " " << entry.second.size() << "\n";
+    for (size_t i = 0; i < entry.second.size(); i++) {
+      os << ((i == 0) ? "" : " ") << entry.second[i];
+    }
+    os << "\n";
+  }
+
+  if (!output.commit()) {
+    ALOGE("Unable to write profile %s! (%s)", pPath.c_str(),
+          output.getErrorMessage().c_str());
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Renderscript/RSProfile.h"
+#include "bcc/Renderscript/RSTransforms.h"
+#include "bcc/Support/Log.h"
+
+#include "bcinfo/MetadataExtractor.h"
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/CallSite.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace bcc;
+
+namespace {
+
+// The functions that are profiled: the expanded kernels, the kernels
+// themselves, the exported invokable functions and every function of the
+// script (pScriptFunctions) that these call, directly or not. The kernels are
+// not inlined yet at this point, so their branches are only seen here.
+bool collectProfiledFunctions(llvm::Module &M,
+                              const std::set<std::string> &pScriptFunctions,
+                              std::vector<llvm::Function *> &pFunctions,
+                              std::string &pBuildChecksum) {
+  bcinfo::MetadataExtractor me(&M);
+  if (!me.extract()) {
+    ALOGE("Could not extract metadata from module!");
+    return false;
+  }
+
+  pBuildChecksum = (me.getBuildChecksum() != nullptr) ?
+                   me.getBuildChecksum() : "";
+
+  llvm::SmallPtrSet<llvm::Function *, 16> Seen;
+  auto addFunction = [&](llvm::Function *F) {
+    if ((F != nullptr) && !F->isDeclaration() && Seen.insert(F).second) {
+      pFunctions.push_back(F);
+    }
+  };
+
+  for (size_t i = 0; i < me.getExportForEachSignatureCount(); i++) {
+    std::string name(me.getExportForEachNameList()[i]);
+    addFunction(M.getFunction(name + ".expand"));
+    addFunction(M.getFunction(name));
+  }
+
+  for (size_t i = 0; i < me.getExportReduceCount(); i++) {
+    std::string name(me.getExportReduceList()[i].mAccumulatorName);
+    addFunction(M.getFunction(name + ".expand"));
+    addFunction(M.getFunction(name));
+  }
+
+  for (size_t i = 0; i < me.getExportFuncCount(); i++) {
+    addFunction(M.getFunction(me.getExportFuncNameList()[i]));
+  }
+
+  // pFunctions grows as the callees are found.
+  for (size_t i = 0; i < pFunctions.size(); i++) {
+    for (llvm::BasicBlock &BB : *pFunctions[i]) {
+      for (llvm::Instruction &I : BB) {
+        llvm::CallSite CS(&I);
+        llvm::Function *Callee = CS ? CS.getCalledFunction() : nullptr;
+        if ((Callee != nullptr) &&
+            (pScriptFunctions.count(Callee->getName()) != 0)) {
+          addFunction(Callee);
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// The conditional branches of F in block order. The instrumentation and the
+// annotation must agree on this order, so both run at the same point of the
+// pipeline (right after RSForEachExpandPass).
+void collectBranches(llvm::Function &F,
+                     std::vector<llvm::BranchInst *> &pBranches) {
+  for (llvm::BasicBlock &BB : F) {
+    llvm::BranchInst *BI = llvm::dyn_cast<llvm::BranchInst>(BB.getTerminator());
+    if ((BI != nullptr) && BI->isConditional()) {
+      pBranches.push_back(BI);
+    }
+  }
+}
+
+/* RSProfileInstrumentPass: Adds the counters described in RSProfile.h to the
+ * expanded kernels, the kernels, the invokable functions and the script
+ * functions they call, and exposes them through the .rs.prof_* symbols.
+ *
+ * The counters are updated with plain loads and stores. Kernels run on
+ * several threads, so some increments are lost, but the ratios between the
+ * counters, which is what the optimizations care about, are preserved well
+ * enough without the cost of atomic updates.
+ */
+class RSProfileInstrumentPass : public llvm::ModulePass {
+private:
+  const std::set<std::string> &mScriptFunctions;
+
+  static void incrementCounter(llvm::IRBuilder<> &Builder,
+                               llvm::GlobalVariable *Counters,
+                               llvm::Value *Index) {
+    llvm::Value *Indices[] = { Builder.getInt32(0), Index };
+    llvm::Value *Addr = Builder.CreateInBoundsGEP(Counters, Indices);
+    llvm::Value *Count = Builder.CreateLoad(Addr);
+    Builder.CreateStore(Builder.CreateAdd(Count, Builder.getInt64(1)), Addr);
+  }
+
+  static llvm::GlobalVariable *createTable(llvm::Module &M, const char *Name,
+                                           llvm::Constant *Init) {
+    return new llvm::GlobalVariable(M, Init->getType(), /* isConstant */true,
+                                    llvm::GlobalValue::ExternalLinkage, Init,
+                                    Name);
+  }
+
+public:
+  static char ID;
+
+  RSProfileInstrumentPass(const std::set<std::string> &pScriptFunctions)
+    : ModulePass(ID), mScriptFunctions(pScriptFunctions) { }
+
+  bool runOnModule(llvm::Module &M) override {
+    std::vector<llvm::Function *> Functions;
+    std::string BuildChecksum;
+    if (!collectProfiledFunctions(M, mScriptFunctions, Functions,
+                                  BuildChecksum)) {
+      return false;
+    }
+
+    llvm::LLVMContext &Context = M.getContext();
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(Context);
+    llvm::Type *Int64Ty = llvm::Type::getInt64Ty(Context);
+    llvm::PointerType *Int8PtrTy = llvm::Type::getInt8PtrTy(Context);
+    llvm::PointerType *Int64PtrTy = llvm::Type::getInt64PtrTy(Context);
+
+    std::vector<llvm::Constant *> Names;
+    std::vector<llvm::Constant *> CounterArrays;
+    std::vector<uint32_t> Sizes;
+
+    auto createString = [&](llvm::StringRef Str, const llvm::Twine &Name) {
+      llvm::Constant *Init = llvm::ConstantDataArray::getString(Context, Str);
+      llvm::GlobalVariable *GV =
+          new llvm::GlobalVariable(M, Init->getType(), /* isConstant */true,
+                                   llvm::GlobalValue::PrivateLinkage, Init,
+                                   Name);
+      GV->setUnnamedAddr(true);
+      return llvm::ConstantExpr::getBitCast(GV, Int8PtrTy);
+    };
+
+    for (llvm::Function *F : Functions) {
+      std::vector<llvm::BranchInst *> Branches;
+      collectBranches(*F, Branches);
+
+      const uint32_t NumCounters = 1 + 2 * Branches.size();
+      llvm::ArrayType *CountersTy = llvm::ArrayType::get(Int64Ty, NumCounters);
+      llvm::GlobalVariable *Counters =
+          new llvm::GlobalVariable(M, CountersTy, /* isConstant */false,
+                                   llvm::GlobalValue::InternalLinkage,
+                                   llvm::ConstantAggregateZero::get(CountersTy),
+                                   F->getName() + ".rs.prof");
+
+      llvm::IRBuilder<> Builder(&*F->getEntryBlock().getFirstInsertionPt());
+      incrementCounter(Builder, Counters, Builder.getInt32(0));
+
+      for (size_t i = 0; i < Branches.size(); i++) {
+        llvm::BranchInst *BI = Branches[i];
+        Builder.SetInsertPoint(BI);
+        llvm::Value *Index =
+            Builder.CreateSelect(BI->getCondition(),
+                                 Builder.getInt32(2 * i + 1),
+                                 Builder.getInt32(2 * i + 2));
+        incrementCounter(Builder, Counters, Index);
+      }
+
+      Names.push_back(createString(F->getName(),
+                                   F->getName() + ".rs.prof_name"));
+      CounterArrays.push_back(
+          llvm::ConstantExpr::getBitCast(Counters, Int64PtrTy));
+      Sizes.push_back(NumCounters);
+    }
+
+    createTable(M, kRsProfChecksum,
+                createString(BuildChecksum, ".rs.prof_checksum_str"));
+    createTable(M, kRsProfEntries,
+                llvm::ConstantInt::get(Int32Ty, Functions.size()));
+    createTable(M, kRsProfNames,
+                llvm::ConstantArray::get(
+                    llvm::ArrayType::get(Int8PtrTy, Names.size()), Names));
+    createTable(M, kRsProfCounters,
+                llvm::ConstantArray::get(
+                    llvm::ArrayType::get(Int64PtrTy, CounterArrays.size()),
+                    CounterArrays));
+    createTable(M, kRsProfSizes, llvm::ConstantDataArray::get(Context, Sizes));
+
+    return true;
+  }
+
+  virtual const char *getPassName() const override {
+    return "Instrument Renderscript Kernels for Profiling";
+  }
+};
+
+/* RSProfileAnnotatePass: Attaches the counts of a profile written by an
+ * instrumented build of the same script as branch weights and function entry
+ * counts, which later passes (block placement in particular) use in place of
+ * their static estimates. A profile of another build (different checksum)
+ * or of differently shaped functions is ignored.
+ */
+class RSProfileAnnotatePass : public llvm::ModulePass {
+private:
+  const RSProfile &mProfile;
+  const std::set<std::string> &mScriptFunctions;
+
+  // Branch weights are 32-bit; scale all counts of a branch alike so that
+  // the largest fits. Never return 0, which would mean "impossible".
+  static void getWeights(uint64_t pTaken, uint64_t pNotTaken,
+                         uint32_t &pTakenWeight, uint32_t &pNotTakenWeight) {
+    unsigned shift = 0;
+    while (((std::max(pTaken, pNotTaken) >> shift) + 1) > UINT32_MAX) {
+      shift++;
+    }
+    pTakenWeight = (pTaken >> shift) + 1;
+    pNotTakenWeight = (pNotTaken >> shift) + 1;
+  }
+
+public:
+  static char ID;
+
+  RSProfileAnnotatePass(const RSProfile &pProfile,
+                        const std::set<std::string> &pScriptFunctions)
+    : ModulePass(ID), mProfile(pProfile), mScriptFunctions(pScriptFunctions) { }
+
+  bool runOnModule(llvm::Module &M) override {
+    std::vector<llvm::Function *> Functions;
+    std::string BuildChecksum;
+    if (!collectProfiledFunctions(M, mScriptFunctions, Functions,
+                                  BuildChecksum)) {
+      return false;
+    }
+
+    if (BuildChecksum != mProfile.getBuildChecksum()) {
+      ALOGE("Ignoring profile of build %s for build %s!",
+            mProfile.getBuildChecksum().c_str(), BuildChecksum.c_str());
+      return false;
+    }
+
+    llvm::MDBuilder MDB(M.getContext());
+    bool Changed = false;
+
+    for (llvm::Function *F : Functions) {
+      const std::vector<uint64_t> *Counters =
+          mProfile.getCounters(F->getName());
+      if (Counters == nullptr) {
+        continue;
+      }
+
+      std::vector<llvm::BranchInst *> Branches;
+      collectBranches(*F, Branches);
+      if (Counters->size() != 1 + 2 * Branches.size()) {
+        ALOGE("Ignoring profile of %s: it does not match the function!",
+              F->getName().str().c_str());
+        continue;
+      }
+
+      F->setEntryCount((*Counters)[0]);
+
+      for (size_t i = 0; i < Branches.size(); i++) {
+        uint64_t Taken = (*Counters)[2 * i + 1];
+        uint64_t NotTaken = (*Counters)[2 * i + 2];
+        if ((Taken == 0) && (NotTaken == 0)) {
+          // Never reached; keep the static estimate.
+          continue;
+        }
+
+        uint32_t TakenWeight, NotTakenWeight;
+        getWeights(Taken, NotTaken, TakenWeight, NotTakenWeight);
+        Branches[i]->setMetadata(llvm::LLVMContext::MD_prof,
+                                 MDB.createBranchWeights(TakenWeight,
+                                                         NotTakenWeight));
+      }
+
+      Changed = true;
+    }
+
+    return Changed;
+  }
+
+  virtual const char *getPassName() const override {
+    return "Annotate Renderscript Kernels with Profile";
+  }
+};
+
+} // end anonymous namespace
+
+char RSProfileInstrumentPass::ID = 0;
+char RSProfileAnnotatePass::ID = 0;
+
+namespace bcc {
+
+llvm::ModulePass *
+createRSProfileInstrumentPass(const std::set<std::string> &pScriptFunctions) {
+  return new RSProfileInstrumentPass(pScriptFunctions);
+}
+
+llvm::ModulePass *
+createRSProfileAnnotatePass(const RSProfile &pProfile,
+                            const std::set<std::string> &pScriptFunctions) {
+  return new RSProfileAnnotatePass(pProfile, pScriptFunctions);
+}
+
+} // end namespace bcc
@@ -94,6 +94,10 @@ public:
     return false;
   }
 
+  virtual const char *getPassName() const override {
+    return "Screen Renderscript Functions";
+  }
+
 };
 
 }
@@ -20,20 +20,74 @@
 #include "bcc/Source.h"
 #include "bcc/Support/Log.h"
 
+#include <llvm/IR/Module.h>
+
+#include <iterator>
+#include <string>
+#include <vector>
+
 using namespace bcc;
 
+namespace {
+
+// Runtime functions that passes in Compiler::runPasses() may introduce calls
+// to after the runtime has been linked (see RSInvokeHelperPass).
+const char *kLateRuntimeReferences[] = {
+  "_Z11rsSetObjectP13rs_allocationS_",
+  "_Z11rsSetObjectP10rs_elementS_",
+  "_Z11rsSetObjectP10rs_samplerS_",
+  "_Z11rsSetObjectP9rs_scriptS_",
+  "_Z11rsSetObjectP7rs_typeS_",
+};
+
+// Collect the names of the globals pModule uses but does not define.
+void collectUndefinedGlobals(const llvm::Module &pModule,
+                             std::vector<std::string> &pNames) {
+  for (const llvm::Function &F : pModule) {
+    if (F.isDeclaration() && !F.isIntrinsic()) {
+      pNames.push_back(F.getName());
+    }
+  }
+  for (const llvm::GlobalVariable &GV : pModule.globals()) {
+    if (GV.isDeclaration()) {
+      pNames.push_back(GV.getName());
+    }
+  }
+}
+
+} // end anonymous namespace
+
 bool RSScript::LinkRuntime(RSScript &pScript, const char *core_lib) {
   bccAssert(core_lib != nullptr);
 
   // Using the same context with the source in pScript.
   BCCContext &context = pScript.getSource().getContext();
 
-  Source *libclcore_source = Source::CreateFromFile(context, core_lib);
+  std::vector<std::string> imports;
+  if (pScript.getSelectiveRuntimeImport()) {
+    collectUndefinedGlobals(pScript.getSource().getModule(), imports);
+    imports.insert(imports.end(), std::begin(kLateRuntimeReferences),
+                   std::end(kLateRuntimeReferences));
+  }
+
+  // The runtime is parsed once per context and copied for every script.
+  Source *libclcore_source = Source::CreateFromRuntimeFile(
+      context, core_lib,
+      pScript.getSelectiveRuntimeImport() ? &imports : nullptr);
   if (libclcore_source == nullptr) {
     ALOGE("Failed to load Renderscript library '%s' to link!", core_lib);
     return false;
   }
 
+  if (pScript.getProfileInstrument() || (pScript.getProfile() != nullptr)) {
+    pScript.mScriptFunctions.clear();
+    for (const llvm::Function &F : pScript.getSource().getModule()) {
+      if (!F.isDeclaration()) {
+        pScript.mScriptFunctions.insert(F.getName());
+      }
+    }
+  }
+
   if (pScript.mLinkRuntimeCallback != nullptr) {
     pScript.mLinkRuntimeCallback(&pScript,
         &pScript.getSource().getModule(), &libclcore_source->getModule());
@@ -45,17 +99,26 @@ bool RSScript::LinkRuntime(RSScript &pScript, const char *core_lib) {
     return false;
   }
 
+  // The linker has moved what it needed out of the copy, so release the rest
+  // now rather than when the context goes away.
+  delete libclcore_source;
+
   return true;
 }
 
 RSScript::RSScript(Source &pSource)
   : Script(pSource), mCompilerVersion(0),
-    mOptimizationLevel(kOptLvl3), mLinkRuntimeCallback(nullptr),
+    mOptimizationLevel(kOptLvl3), mInlineThreshold(-1),
+    mRegAlloc(CompilerConfig::kRegAllocDefault), mLinkRuntimeCallback(nullptr),
     mEmbedInfo(false), mEmbedGlobalInfo(false),
-    mEmbedGlobalInfoSkipConstant(false) { }
+    mEmbedGlobalInfoSkipConstant(false), mSelectiveRuntimeImport(false),
+    mProfileInstrument(false), mProfile(nullptr) { }
 
 bool RSScript::doReset() {
   mCompilerVersion = 0;
   mOptimizationLevel = kOptLvl3;
+  mInlineThreshold = -1;
+  mRegAlloc = CompilerConfig::kRegAllocDefault;
+  mScriptFunctions.clear();
   return true;
 }
@@ -38,14 +38,13 @@ namespace {
 
 const Function* getInvokeFunction(const Source& source, const int slot,
                                   Module* newModule) {
-  Module* module = const_cast<Module*>(&source.getModule());
-  bcinfo::MetadataExtractor metadata(module);
-  if (!metadata.extract()) {
+  const bcinfo::MetadataExtractor* metadata = source.getMetadata();
+  if (metadata == nullptr) {
     ALOGE("Kernel fusion (module %s slot %d): failed to extract metadata",
           source.getName().c_str(), slot);
     return nullptr;
   }
-  const char* functionName = metadata.getExportFuncNameList()[slot];
+  const char* functionName = metadata->getExportFuncNameList()[slot];
   Function* func = newModule->getFunction(functionName);
   // Materialize the function so that later the caller can inspect its argument
   // and return types.
@@ -56,24 +55,28 @@ const Function* getInvokeFunction(const Source& source, const int slot,
 const Function*
 getFunction(Module* mergedModule, const Source* source, const int slot,
             uint32_t* signature) {
-  bcinfo::MetadataExtractor metadata(&source->getModule());
-  metadata.extract();
+  const bcinfo::MetadataExtractor* metadata = source->getMetadata();
+  if (metadata == nullptr) {
+    ALOGE("Kernel fusion (module %s slot %d): failed to extract metadata",
+          source->getName().c_str(), slot);
+    return nullptr;
+  }
 
-  const char* functionName = metadata.getExportForEachNameList()[slot];
+  const char* functionName = metadata->getExportForEachNameList()[slot];
   if (functionName == nullptr || !functionName[0]) {
     ALOGE("Kernel fusion (module %s slot %d): failed to find kernel function",
           source->getName().c_str(), slot);
     return nullptr;
   }
 
-  if (metadata.getExportForEachInputCountList()[slot] > 1) {
+  if (metadata->getExportForEachInputCountList()[slot] > 1) {
     ALOGE("Kernel fusion (module %s function %s): cannot handle multiple inputs",
           source->getName().c_str(), functionName);
     return nullptr;
   }
 
   if (signature != nullptr) {
-    *signature = metadata.getExportForEachSignatureList()[slot];
+    *signature = metadata->getExportForEachSignatureList()[slot];
   }
 
   const Function* function = mergedModule->getFunction(functionName);
@@ -103,16 +106,20 @@ int getFusedFuncSig(const std::vector<Source*>& sources,
   auto slotIter = slots.begin();
   for (const Source* source : sources) {
     const int slot = *slotIter++;
-    bcinfo::MetadataExtractor metadata(&source->getModule());
-    metadata.extract();
+    const bcinfo::MetadataExtractor* metadata = source->getMetadata();
+    if (metadata == nullptr) {
+      ALOGE("Kernel fusion (module %s slot %d): failed to extract metadata",
+            source->getName().c_str(), slot);
+      return -1;
+    }
 
-    if (metadata.getExportForEachInputCountList()[slot] > 1) {
+    if (metadata->getExportForEachInputCountList()[slot] > 1) {
       ALOGE("Kernel fusion (module %s slot %d): cannot handle multiple inputs",
             source->getName().c_str(), slot);
       return -1;
     }
 
-    signature = metadata.getExportForEachSignatureList()[slot];
+    signature = metadata->getExportForEachSignatureList()[slot];
     if (signature & ~ExpectedSignatureBits) {
       ALOGE("Kernel fusion (module %s slot %d): Unexpected signature %x",
             source->getName().c_str(), slot, signature);
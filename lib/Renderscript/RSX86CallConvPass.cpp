@@ -201,6 +201,10 @@ public:
     return FunctionsToHandle.size() > 0;
   }
 
+  virtual const char *getPassName() const override {
+    return "Fix Renderscript X86_64 Calling Convention";
+  }
+
 };
 
 }
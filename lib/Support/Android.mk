@@ -22,11 +22,15 @@ LOCAL_PATH := $(call my-dir)
 #=====================================================================
 
 libbcc_support_SRC_FILES := \
+  AtomicOutputFile.cpp \
+  CompilePassReport.cpp \
+  CompilePhaseTimes.cpp \
   CompilerConfig.cpp \
   Disassembler.cpp \
   FileBase.cpp \
   Initialization.cpp \
   InputFile.cpp \
+  ObjectCache.cpp \
   OutputFile.cpp \
 
 #=====================================================================
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/AtomicOutputFile.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace bcc;
+
+AtomicOutputFile::AtomicOutputFile(const std::string &pPath)
+  : mPath(pPath), mStream(nullptr) {
+  // The temporary must be on the same file system as the destination for
+  // rename() to be atomic, so create it right next to it.
+  int fd;
+  mError = llvm::sys::fs::createUniqueFile(pPath + ".tmp-%%%%%%%%", fd,
+                                           mTempPath);
+  if (mError) {
+    return;
+  }
+
+  mStream = new (std::nothrow) llvm::raw_fd_ostream(fd, /* shouldClose */true);
+  if (mStream == nullptr) {
+    mError = std::make_error_code(std::errc::not_enough_memory);
+    llvm::sys::fs::remove(mTempPath.str());
+  }
+}
+
+AtomicOutputFile::~AtomicOutputFile() {
+  discard();
+}
+
+void AtomicOutputFile::discard() {
+  if (mStream != nullptr) {
+    mStream->close();
+    // raw_fd_ostream aborts on destruction with a pending error.
+    mStream->clear_error();
+    delete mStream;
+    mStream = nullptr;
+    llvm::sys::fs::remove(mTempPath.str());
+  }
+}
+
+bool AtomicOutputFile::commit() {
+  if (hasError() || (mStream == nullptr)) {
+    return false;
+  }
+
+  mStream->close();
+  if (mStream->has_error()) {
+    mError = std::make_error_code(std::errc::io_error);
+    discard();
+    return false;
+  }
+  delete mStream;
+  mStream = nullptr;
+
+  mError = llvm::sys::fs::rename(mTempPath.str(), mPath);
+  if (mError) {
+    llvm::sys::fs::remove(mTempPath.str());
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/CompilePassReport.h"
+
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+
+using namespace bcc;
+
+namespace {
+
+void printJSONString(llvm::raw_ostream &pOS, const std::string &pString) {
+  pOS << '"';
+  for (char c : pString) {
+    if ((c == '"') || (c == '\\')) {
+      pOS << '\\';
+    }
+    pOS << c;
+  }
+  pOS << '"';
+}
+
+} // end anonymous namespace
+
+double CompilePassReport::getTotal() const {
+  double total = 0;
+  for (const Entry &entry : mEntries) {
+    total += entry.mSeconds;
+  }
+  return total;
+}
+
+void CompilePassReport::printJSON(llvm::raw_ostream &pOS) const {
+  pOS << "[";
+  for (size_t i = 0; i < mEntries.size(); i++) {
+    const Entry &entry = mEntries[i];
+    pOS << ((i == 0) ? "\n" : ",\n") << "  {\"pass\": ";
+    printJSONString(pOS, entry.mPassName);
+    pOS << ", \"ms\": " << llvm::format("%.3f", entry.mSeconds * 1000)
+        << ", \"insts_before\": " << entry.mInstructionsBefore
+        << ", \"insts_after\": " << entry.mInstructionsAfter
+        << ", \"funcs_before\": " << entry.mFunctionsBefore
+        << ", \"funcs_after\": " << entry.mFunctionsAfter << "}";
+  }
+  pOS << "\n]\n";
+}
+
+void CompilePassReport::print(llvm::raw_ostream &pOS) const {
+  std::vector<const Entry *> sorted;
+  for (const Entry &entry : mEntries) {
+    sorted.push_back(&entry);
+  }
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Entry *pA, const Entry *pB) {
+                     return pA->mSeconds > pB->mSeconds;
+                   });
+
+  const double total = getTotal();
+  pOS << llvm::format("%10s %7s %9s %9s %6s %6s  %s\n", "ms", "%",
+                      "insts", "insts'", "funcs", "funcs'", "pass");
+  for (const Entry *entry : sorted) {
+    pOS << llvm::format("%10.3f %6.1f%% %9u %9u %6u %6u  %s\n",
+                        entry->mSeconds * 1000,
+                        (total > 0) ? (entry->mSeconds * 100 / total) : 0.0,
+                        entry->mInstructionsBefore, entry->mInstructionsAfter,
+                        entry->mFunctionsBefore, entry->mFunctionsAfter,
+                        entry->mPassName.c_str());
+  }
+  pOS << llvm::format("%10.3f %6.1f%%  total\n", total * 1000, 100.0);
+}
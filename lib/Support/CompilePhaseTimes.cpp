@@ -0,0 +1,65 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/CompilePhaseTimes.h"
+
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "bcc/Assert.h"
+
+using namespace bcc;
+
+const char *CompilePhaseTimes::GetPhaseName(Phase pPhase) {
+  switch (pPhase) {
+  case kLoad:
+    return "load";
+  case kMaterialize:
+    return "materialize";
+  case kScreen:
+    return "screen";
+  case kLink:
+    return "link";
+  case kIRPasses:
+    return "ir_passes";
+  case kCodeGen:
+    return "codegen";
+  case kWrite:
+    return "write";
+  case kNumPhases:
+    break;
+  }
+
+  bccAssert(false && "Unknown compile phase encountered");
+  return "";
+}
+
+double CompilePhaseTimes::getTotal() const {
+  double total = 0;
+  for (unsigned i = 0; i < kNumPhases; i++) {
+    total += mSeconds[i];
+  }
+  return total;
+}
+
+void CompilePhaseTimes::printJSON(llvm::raw_ostream &pOS) const {
+  pOS << "{";
+  for (unsigned i = 0; i < kNumPhases; i++) {
+    pOS << "\"" << GetPhaseName(static_cast<Phase>(i)) << "_ms\": ";
+    pOS << llvm::format("%.3f", mSeconds[i] * 1000) << ", ";
+  }
+  pOS << "\"total_ms\": " << llvm::format("%.3f", getTotal() * 1000) << "}\n";
+}
@@ -22,6 +22,7 @@
 #include <llvm/MC/SubtargetFeature.h>
 #include <llvm/Support/Host.h>
 #include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include "bcc/Support/Log.h"
 
@@ -48,7 +49,10 @@ bool HasF16C() {
 #endif // (PROVIDE_X86_CODEGEN) && !defined(__HOST__)
 
 CompilerConfig::CompilerConfig(const std::string &pTriple)
-  : mTriple(pTriple), mFullPrecision(true), mTarget(nullptr) {
+  : mTriple(pTriple), mFullPrecision(true), mVectorize(false),
+    mRSPipeline(false), mMultiVersion(false), mExpandTiles(false),
+    mInlineThreshold(-1),
+    mRegAlloc(kRegAllocDefault), mTarget(nullptr) {
   //===--------------------------------------------------------------------===//
   // Default setting of register sheduler
   //===--------------------------------------------------------------------===//
@@ -116,6 +120,16 @@ bool CompilerConfig::initializeArch() {
     return false;
   }
 
+  // rs_fp_relaxed allows the extra precision of fused multiply-adds; full
+  // precision only allows fusing what the front end marked with fmuladd.
+  if (mFullPrecision) {
+    mTargetOpts.AllowFPOpFusion = llvm::FPOpFusion::Standard;
+    mTargetOpts.LessPreciseFPMADOption = false;
+  } else {
+    mTargetOpts.AllowFPOpFusion = llvm::FPOpFusion::Fast;
+    mTargetOpts.LessPreciseFPMADOption = true;
+  }
+
   // Configure each architecture for any necessary additional flags.
   switch (mArchType) {
 #if defined(PROVIDE_ARM_CODEGEN)
@@ -271,3 +285,39 @@ void CompilerConfig::setFeatureString(const std::vector<std::string> &pAttrs) {
   mFeatureString = f.getString();
   return;
 }
+
+std::string CompilerConfig::serializeTarget() const {
+  std::string result;
+  llvm::raw_string_ostream os(result);
+
+  os << "triple=" << mTriple
+     << ";cpu=" << mCPU
+     << ";features=" << mFeatureString
+     << ";opt=" << static_cast<int>(mOptLevel)
+     << ";reloc=" << static_cast<int>(mRelocModel)
+     << ";codemodel=" << static_cast<int>(mCodeModel)
+     << ";floatabi=" << static_cast<int>(mTargetOpts.FloatABIType)
+     << ";fpopfusion=" << static_cast<int>(mTargetOpts.AllowFPOpFusion)
+     << ";lessprecisefpmad=" << mTargetOpts.LessPreciseFPMADOption
+     << ";unsafefpmath=" << mTargetOpts.UnsafeFPMath
+     << ";noframepointerelim=" << mTargetOpts.NoFramePointerElim
+     << ";initarray=" << mTargetOpts.UseInitArray;
+
+  return os.str();
+}
+
+std::string CompilerConfig::serialize() const {
+  std::string result;
+  llvm::raw_string_ostream os(result);
+
+  os << serializeTarget()
+     << ";fullprecision=" << mFullPrecision
+     << ";vectorize=" << mVectorize
+     << ";rspipeline=" << mRSPipeline
+     << ";multiversion=" << mMultiVersion
+     << ";expandtiles=" << mExpandTiles
+     << ";inline=" << mInlineThreshold
+     << ";regalloc=" << static_cast<int>(mRegAlloc);
+
+  return os.str();
+}
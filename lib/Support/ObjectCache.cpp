@@ -0,0 +1,127 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bcc/Support/ObjectCache.h"
+
+#include "bcc/Support/AtomicOutputFile.h"
+#include "bcc/Support/FileMutex.h"
+#include "bcc/Support/Log.h"
+#include "bcc/Support/OutputFile.h"
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <memory>
+
+using namespace bcc;
+
+namespace {
+
+// Write the whole of pBuffer to the (already opened) pOutput. Return false on
+// any I/O error.
+bool writeBuffer(OutputFile &pOutput, const llvm::MemoryBuffer &pBuffer) {
+  llvm::raw_fd_ostream *os = pOutput.dup();
+  if (os == nullptr) {
+    return false;
+  }
+
+  os->write(pBuffer.getBufferStart(), pBuffer.getBufferSize());
+  os->close();
+
+  bool failed = os->has_error();
+  // raw_fd_ostream aborts on destruction with a pending error.
+  os->clear_error();
+  delete os;
+
+  return !failed;
+}
+
+// Publish the whole of pData at pPath through a write-then-rename, so that
+// readers of pPath either see its previous contents or all of pData. Return
+// false on any I/O error.
+bool publishBuffer(const std::string &pPath, llvm::StringRef pData) {
+  AtomicOutputFile output(pPath);
+  if (output.hasError()) {
+    return false;
+  }
+
+  output.getStream().write(pData.data(), pData.size());
+  return output.commit();
+}
+
+} // end anonymous namespace
+
+ObjectCache::ObjectCache(const std::string &pCacheDir)
+  : mCacheDir(pCacheDir) { }
+
+std::string ObjectCache::getEntryPath(const std::string &pKey) const {
+  return mCacheDir + "/" + pKey + ".o";
+}
+
+bool ObjectCache::retrieve(const std::string &pKey, const char *pOutputPath,
+                           bool pAtomicPublish) const {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer> > entry =
+      llvm::MemoryBuffer::getFile(getEntryPath(pKey), -1,
+                                  /* RequiresNullTerminator */ false);
+  if (!entry) {
+    // A missing entry is the common case and not worth a log message.
+    return false;
+  }
+
+  if (pAtomicPublish) {
+    // The output is replaced by rename(), so no FileMutex is needed: a
+    // concurrent reader never observes a partially copied object.
+    if (!publishBuffer(pOutputPath, (*entry)->getBuffer())) {
+      ALOGE("Unable to copy cached object %s to %s!", pKey.c_str(),
+            pOutputPath);
+      return false;
+    }
+    return true;
+  }
+
+#ifndef USE_MINGW
+  // Take the same lock compileScript() takes on the output.
+  FileMutex<FileBase::kWriteLock> write_output_mutex(pOutputPath);
+
+  if (write_output_mutex.hasError() || !write_output_mutex.lock()) {
+    ALOGE("Unable to acquire the lock for writing %s! (%s)",
+          pOutputPath, write_output_mutex.getErrorMessage().c_str());
+    return false;
+  }
+#endif
+
+  OutputFile output_file(pOutputPath,
+                         FileBase::kTruncate | FileBase::kBinary);
+  if (output_file.hasError() || !writeBuffer(output_file, **entry)) {
+    ALOGE("Unable to copy cached object %s to %s!", pKey.c_str(), pOutputPath);
+    return false;
+  }
+
+  return true;
+}
+
+bool ObjectCache::insert(const std::string &pKey, const char *pObject,
+                         size_t pObjectSize) const {
+  if (!publishBuffer(getEntryPath(pKey),
+                     llvm::StringRef(pObject, pObjectSize))) {
+    ALOGE("Unable to insert %s into object cache %s!", pKey.c_str(),
+          mCacheDir.c_str());
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,5 @@
+; An empty stand-in for libclcore.bc, for tests whose scripts do not call
+; into the runtime.
+
+target datalayout = "e-m:e-p:32:32-i64:64-v128:64:128-a:0:32-n32-S64"
+target triple = "armv7-none-linux-gnueabi"
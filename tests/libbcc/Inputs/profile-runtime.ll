@@ -0,0 +1,18 @@
+; A stand-in for libclcore.bc with one runtime function, which must not be
+; mistaken for a function of the script when profiling.
+
+target datalayout = "e-m:e-p:32:32-i64:64-v128:64:128-a:0:32-n32-S64"
+target triple = "armv7-none-linux-gnueabi"
+
+define i32 @_Z5clampiii(i32 %val, i32 %lo, i32 %hi) {
+  %below = icmp slt i32 %val, %lo
+  br i1 %below, label %low, label %check_high
+
+low:
+  ret i32 %lo
+
+check_high:
+  %above = icmp sgt i32 %val, %hi
+  %res = select i1 %above, i32 %hi, i32 %val
+  ret i32 %res
+}
@@ -0,0 +1,84 @@
+; Check that -rs-profile-instrument counts the kernels, their expanded
+; wrappers and the script functions they call, but not the runtime, and that
+; -rs-profile-use turns a profile of the same build into branch weights and
+; entry counts.
+
+; RUN: %llvm-as %S/Inputs/profile-runtime.ll -o %t.rt.bc
+; RUN: %llvm-as %s -o %t.bc
+; RUN: rm -rf %t.dir && mkdir -p %t.dir
+; RUN: %rs-bcc -build-checksum abc123 -rs-profile-instrument -emit-llvm -output_path %t.dir -o instr %t.bc
+; RUN: %FileCheck %s -check-prefix=INSTR < %t.dir/instr.o.ll
+; RUN: %FileCheck %s -check-prefix=RUNTIME < %t.dir/instr.o.ll
+; RUN: %rs-bcc -build-checksum abc123 -rs-profile-use %S/Inputs/profile.prof -emit-llvm -output_path %t.dir -o use %t.bc
+; RUN: %FileCheck %s -check-prefix=USE < %t.dir/use.o.ll
+
+; The expanded kernel, the kernel, then its callees in the order found.
+; INSTR-DAG: c"abc123\00"
+; INSTR-DAG: c"bump.expand\00"
+; INSTR-DAG: c"bump\00"
+; INSTR-DAG: c"helper\00"
+; INSTR-DAG: c"hot\00"
+; INSTR-DAG: c"cold\00"
+; INSTR-DAG: @.rs.prof_entries = constant i32 5
+; INSTR-DAG: @.rs.prof_sizes = constant [5 x i32] [i32 {{[0-9]+}}, i32 1, i32 3, i32 1, i32 1]
+
+; _Z5clampiii comes from the runtime.
+; RUNTIME-NOT: c"_Z5clampiii\00"
+
+; helper is inlined after the annotation, so its weights end up in
+; bump.expand; the successors may have been swapped along the way.
+; USE: define void @bump.expand(
+; USE: br i1 {{.*}}, !prof ![[WEIGHTS:[0-9]+]]
+; USE-DAG: ![[WEIGHTS]] = !{!"branch_weights", i32 {{11, i32 991|991, i32 11}}}
+; USE-DAG: !{!"function_entry_count", i64 10}
+; USE-DAG: !{!"function_entry_count", i64 990}
+
+target datalayout = "e-m:e-p:32:32-i64:64-v128:64:128-a:0:32-n32-S64"
+target triple = "armv7-none-linux-gnueabi"
+
+@hot_count = internal global i32 0, align 4
+@cold_count = internal global i32 0, align 4
+
+declare i32 @_Z5clampiii(i32, i32, i32)
+
+define internal void @hot() noinline {
+  %old = load i32, i32* @hot_count, align 4
+  %new = add i32 %old, 1
+  store i32 %new, i32* @hot_count, align 4
+  ret void
+}
+
+define internal void @cold() noinline {
+  %old = load i32, i32* @cold_count, align 4
+  %new = add i32 %old, 1
+  store i32 %new, i32* @cold_count, align 4
+  ret void
+}
+
+define internal i32 @helper(i32 %in) {
+  %big = icmp sgt i32 %in, 100
+  br i1 %big, label %is_hot, label %is_cold
+
+is_hot:
+  call void @hot()
+  br label %done
+
+is_cold:
+  call void @cold()
+  br label %done
+
+done:
+  %res = call i32 @_Z5clampiii(i32 %in, i32 0, i32 255)
+  ret i32 %res
+}
+
+define i32 @bump(i32 %in) {
+  %res = call i32 @helper(i32 %in)
+  ret i32 %res
+}
+
+!\23rs_export_foreach_name = !{!0}
+!\23rs_export_foreach = !{!1}
+
+!0 = !{!"bump"}
+!1 = !{!"35"}
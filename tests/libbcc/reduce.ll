@@ -0,0 +1,108 @@
+; Check that bcinfo parses #rs_export_reduce and that bcc expands the
+; accumulators and, where it can, generates the missing combiners. An
+; accumulator wider than the data the runtime allocates is not expanded.
+
+; RUN: %rs-runtime
+; RUN: %llvm-as %s -o %t.bc
+; RUN: %bcinfo -a 10000 -v %t.bc | %FileCheck %s -check-prefix=INFO
+; RUN: rm -rf %t.dir && mkdir -p %t.dir
+; RUN: %rs-bcc -emit-llvm -output_path %t.dir -o reduce %t.bc
+; RUN: %FileCheck %s -check-prefix=IR < %t.dir/reduce.o.ll
+; RUN: %FileCheck %s -check-prefix=ABSENT < %t.dir/reduce.o.ll
+
+; INFO: exportReduceCount: 3
+; INFO-NEXT: exportReduceList[0]: sum - 0x00000000 - 1 - 4
+; INFO-NEXT:   initializer: initint
+; INFO-NEXT:   accumulator: addint
+; INFO-NEXT:   combiner: <none>
+; INFO-NEXT:   outconverter: <none>
+; INFO-NEXT: exportReduceList[1]: dot - 0x00000008 - 2 - 4
+; INFO-NEXT:   initializer: <none>
+; INFO-NEXT:   accumulator: dotacc
+; INFO-NEXT:   combiner: dotcomb
+; INFO-NEXT:   outconverter: dotout
+; INFO-NEXT: exportReduceList[2]: wide - 0x00000000 - 1 - 4
+; INFO-NEXT:   initializer: <none>
+; INFO-NEXT:   accumulator: wideacc
+; INFO-NEXT:   combiner: <none>
+; INFO-NEXT:   outconverter: <none>
+
+; The accumulators are expanded and the expanded functions exported.
+; IR-DAG: define void @addint.expand({{.*}}, i32 %x1, i32 %x2, i8* {{.*}}%accum)
+; IR-DAG: define void @dotacc.expand({{.*}}, i32 %x1, i32 %x2, i8* {{.*}}%accum)
+
+; addint takes a single input of its accumulator type and no special
+; arguments, so it doubles as the combiner of sum.
+; IR-DAG: define void @addint.combiner(i32* {{.*}}%accum, i32* {{.*}}%other)
+
+; The functions the runtime calls directly stay exported.
+; IR-DAG: define void @initint(
+; IR-DAG: define void @dotcomb(
+; IR-DAG: define void @dotout(
+
+; dot has its own combiner, and dotacc could not serve as one anyway.
+; ABSENT-NOT: @dotacc.combiner
+; wideacc updates 8 bytes of accumulator data, but wide only has 4.
+; ABSENT-NOT: @wideacc.expand
+; ABSENT-NOT: @wideacc.combiner
+; The accumulators themselves are internal.
+; ABSENT-NOT: define void @addint(
+; ABSENT-NOT: define void @dotacc(
+
+target datalayout = "e-m:e-p:32:32-i64:64-v128:64:128-a:0:32-n32-S64"
+target triple = "armv7-none-linux-gnueabi"
+
+define void @initint(i32* %accum) {
+  store i32 0, i32* %accum, align 4
+  ret void
+}
+
+define void @addint(i32* %accum, i32 %in) {
+  %old = load i32, i32* %accum, align 4
+  %new = add i32 %old, %in
+  store i32 %new, i32* %accum, align 4
+  ret void
+}
+
+define void @dotacc(float* %accum, float %a, float %b, i32 %x) {
+  %old = load float, float* %accum, align 4
+  %prod = fmul float %a, %b
+  %new = fadd float %old, %prod
+  store float %new, float* %accum, align 4
+  ret void
+}
+
+define void @wideacc(i64* %accum, i32 %in) {
+  %old = load i64, i64* %accum, align 8
+  %ext = sext i32 %in to i64
+  %new = add i64 %old, %ext
+  store i64 %new, i64* %accum, align 8
+  ret void
+}
+
+define void @dotcomb(float* %accum, float* %other) {
+  %old = load float, float* %accum, align 4
+  %in = load float, float* %other, align 4
+  %new = fadd float %old, %in
+  store float %new, float* %accum, align 4
+  ret void
+}
+
+define void @dotout(float* %result, float* %accum) {
+  %val = load float, float* %accum, align 4
+  store float %val, float* %result, align 4
+  ret void
+}
+
+!\23rs_export_reduce = !{!0, !5, !9}
+
+!0 = !{!"sum", !"4", !1, !2, !3, !3}
+!1 = !{!"initint"}
+!2 = !{!"addint", !"0"}
+!3 = !{}
+!5 = !{!"dot", !"4", !3, !6, !7, !8}
+!6 = !{!"dotacc", !"8"}
+!7 = !{!"dotcomb"}
+!8 = !{!"dotout"}
+!9 = !{!"wide", !"4", !3, !10, !3, !3}
+!10 = !{!"wideacc", !"0"}
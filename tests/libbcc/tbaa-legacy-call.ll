@@ -0,0 +1,30 @@
+; The callee could index past the cell, so root may not get the TBAA.
+
+; RUN: %rs-runtime
+; RUN: %llvm-as %s -o %t.bc
+; RUN: rm -rf %t.dir && mkdir -p %t.dir
+; RUN: %rs-bcc -emit-llvm -output_path %t.dir -o tbaa %t.bc
+; RUN: %FileCheck %s < %t.dir/tbaa.o.ll
+
+; CHECK: define void @root.expand(
+; CHECK-NOT: !"allocation"
+
+target datalayout = "e-m:e-p:32:32-i64:64-v128:64:128-a:0:32-n32-S64"
+target triple = "armv7-none-linux-gnueabi"
+
+define i32 @first(i32* %p) {
+  %v = load i32, i32* %p, align 4
+  ret i32 %v
+}
+
+define void @root(i32* %in, i32* %out) {
+  %v = call i32 @first(i32* %in)
+  store i32 %v, i32* %out, align 4
+  ret void
+}
+
+!\23rs_export_foreach_name = !{!0}
+!\23rs_export_foreach = !{!1}
+
+!0 = !{!"root"}
+!1 = !{!"3"}
@@ -0,0 +1,27 @@
+; An input pointer that is compared with the output is not a plain access.
+
+; RUN: %rs-runtime
+; RUN: %llvm-as %s -o %t.bc
+; RUN: rm -rf %t.dir && mkdir -p %t.dir
+; RUN: %rs-bcc -emit-llvm -output_path %t.dir -o tbaa %t.bc
+; RUN: %FileCheck %s < %t.dir/tbaa.o.ll
+
+; CHECK: define void @root.expand(
+; CHECK-NOT: !"allocation"
+
+target datalayout = "e-m:e-p:32:32-i64:64-v128:64:128-a:0:32-n32-S64"
+target triple = "armv7-none-linux-gnueabi"
+
+define void @root(i32* %in, i32* %out) {
+  %same = icmp eq i32* %in, %out
+  %v = load i32, i32* %in, align 4
+  %r = select i1 %same, i32 0, i32 %v
+  store i32 %r, i32* %out, align 4
+  ret void
+}
+
+!\23rs_export_foreach_name = !{!0}
+!\23rs_export_foreach = !{!1}
+
+!0 = !{!"root"}
+!1 = !{!"3"}
@@ -0,0 +1,28 @@
+; Once the output pointer escapes to @saved, others can write through it.
+
+; RUN: %rs-runtime
+; RUN: %llvm-as %s -o %t.bc
+; RUN: rm -rf %t.dir && mkdir -p %t.dir
+; RUN: %rs-bcc -emit-llvm -output_path %t.dir -o tbaa %t.bc
+; RUN: %FileCheck %s < %t.dir/tbaa.o.ll
+
+; CHECK: define void @root.expand(
+; CHECK-NOT: !"allocation"
+
+target datalayout = "e-m:e-p:32:32-i64:64-v128:64:128-a:0:32-n32-S64"
+target triple = "armv7-none-linux-gnueabi"
+
+@saved = global i32* null, align 4
+
+define void @root(i32* %in, i32* %out) {
+  %v = load i32, i32* %in, align 4
+  store i32 %v, i32* %out, align 4
+  store i32* %out, i32** @saved, align 4
+  ret void
+}
+
+!\23rs_export_foreach_name = !{!0}
+!\23rs_export_foreach = !{!1}
+
+!0 = !{!"root"}
+!1 = !{!"3"}
@@ -0,0 +1,37 @@
+; A legacy kernel that only accesses its current input and output cells
+; keeps the allocation TBAA and alias scope on those accesses, so they can
+; be reordered with respect to each other and to the driver state.
+
+; RUN: %rs-runtime
+; RUN: %llvm-as %s -o %t.bc
+; RUN: rm -rf %t.dir && mkdir -p %t.dir
+; RUN: %rs-bcc -emit-llvm -output_path %t.dir -o tbaa %t.bc
+; RUN: %FileCheck %s < %t.dir/tbaa.o.ll
+
+; CHECK: define void @root.expand(
+; CHECK: load i32, i32* {{.*}}!tbaa ![[ALLOC:[0-9]+]]{{.*}}, !alias.scope ![[SCOPE:[0-9]+]]
+; CHECK: store i32 {{.*}}!tbaa ![[ALLOC]]{{.*}}, !alias.scope ![[SCOPE]]
+; CHECK-DAG: ![[ALLOC]] = !{![[TYPE:[0-9]+]], ![[TYPE]], i64 0}
+; CHECK-DAG: ![[TYPE]] = !{!"allocation",
+
+target datalayout = "e-m:e-p:32:32-i64:64-v128:64:128-a:0:32-n32-S64"
+target triple = "armv7-none-linux-gnueabi"
+
+%struct.pair = type { i32, i32 }
+
+; Constant offsets within the cell are fine.
+define void @root(%struct.pair* %in, i32* %out) {
+  %first.addr = getelementptr inbounds %struct.pair, %struct.pair* %in, i32 0, i32 0
+  %second.addr = getelementptr inbounds %struct.pair, %struct.pair* %in, i32 0, i32 1
+  %first = load i32, i32* %first.addr, align 4
+  %second = load i32, i32* %second.addr, align 4
+  %sum = add i32 %first, %second
+  store i32 %sum, i32* %out, align 4
+  ret void
+}
+
+!\23rs_export_foreach_name = !{!0}
+!\23rs_export_foreach = !{!1}
+
+!0 = !{!"root"}
+!1 = !{!"3"}
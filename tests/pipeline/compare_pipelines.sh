@@ -0,0 +1,144 @@
+#!/bin/bash -e
+
+# Copyright 2015, The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Compares the generic LTO pipeline of bcc with the one tuned for RenderScript
+# (bcc -rs-pipeline, see Compiler::addRSOptimizationPasses()) at several
+# inlining thresholds, 1000 being the default of the latter.
+#
+# Every script is compiled RUNS times per configuration with -time-phases,
+# and the median phase times and the object size are reported. One more
+# compilation with -instrument-passes leaves the cost of every pass in
+# <out>/<configuration>/<script>.passes for a closer look.
+#
+# The scripts are bitcode files from llvm-rs-cc (for example the
+# intermediates of a CTS or benchmark app) or LLVM assembly files, which are
+# assembled with llvm-as first.
+#
+# -rs-pipeline stays opt-in until this comparison has shown it, and its
+# default threshold, to be at least as good as the generic pipeline.
+
+PROGNAME=$(basename $0)
+BCC=bcc
+LLVM_AS=llvm-as
+BCLIB=""
+TRIPLE=armv7-none-linux-gnueabi
+RUNS=5
+THRESHOLDS="225 500 1000 2000"
+OUT_DIR=pipeline-comparison
+SCRIPTS=""
+
+usage ()
+{
+    echo "Usage: $PROGNAME [options] <script.bc|script.ll>..."
+    echo ""
+    echo "Options:"
+    echo "  -bcc <path>          bcc to run (default: $BCC)"
+    echo "  -llvm-as <path>      llvm-as for .ll scripts (default: $LLVM_AS)"
+    echo "  -bclib <path>        runtime library to link (required)"
+    echo "  -mtriple <triple>    target (default: $TRIPLE)"
+    echo "  -runs <n>            compilations per configuration (default: $RUNS)"
+    echo "  -thresholds <list>   inlining thresholds of the RS pipeline"
+    echo "                       (default: \"$THRESHOLDS\")"
+    echo "  -out <dir>           where to put the objects and pass reports"
+    echo "                       (default: $OUT_DIR)"
+    exit 1
+}
+
+check_param ()
+{
+    if [ -z "$2" ]; then
+        echo "ERROR: Missing parameter after option '$1'"
+        exit 1
+    fi
+}
+
+while [ -n "$1" ]; do
+    case "$1" in
+        -bcc) check_param $1 $2; BCC=$2; shift;;
+        -llvm-as) check_param $1 $2; LLVM_AS=$2; shift;;
+        -bclib) check_param $1 $2; BCLIB=$2; shift;;
+        -mtriple) check_param $1 $2; TRIPLE=$2; shift;;
+        -runs) check_param $1 $2; RUNS=$2; shift;;
+        -thresholds) check_param $1 "$2"; THRESHOLDS=$2; shift;;
+        -out) check_param $1 $2; OUT_DIR=$2; shift;;
+        -h|-help|--help) usage;;
+        -*) echo "ERROR: Unknown option '$1'"; usage;;
+        *) SCRIPTS="$SCRIPTS $1";;
+    esac
+    shift
+done
+
+if [ -z "$BCLIB" ] || [ -z "$SCRIPTS" ]; then
+    usage
+fi
+
+# Configurations as "<name>:<bcc options>".
+CONFIGS="lto:"
+for threshold in $THRESHOLDS; do
+    CONFIGS="$CONFIGS rs-inline-$threshold:-rs-pipeline,-rs-inline-threshold,$threshold"
+done
+
+# Print the median of the numbers on stdin.
+median ()
+{
+    sort -n | awk '{ v[NR] = $1 }
+                   END { if (NR % 2) print v[(NR + 1) / 2];
+                         else printf "%.3f\n", (v[NR / 2] + v[NR / 2 + 1]) / 2 }'
+}
+
+# Print the value of the key $1 in the -time-phases JSON on stdin.
+phase_ms ()
+{
+    sed -n "s/.*\"$1_ms\": \([0-9.]*\).*/\1/p"
+}
+
+mkdir -p $OUT_DIR/inputs
+printf "%-24s %-20s %12s %12s %12s %12s\n" script configuration \
+    ir_passes_ms codegen_ms total_ms object_bytes
+
+for script in $SCRIPTS; do
+    name=$(basename $script)
+    name=${name%.*}
+    input=$script
+    if [ "${script##*.}" = "ll" ]; then
+        input=$OUT_DIR/inputs/$name.bc
+        $LLVM_AS $script -o $input
+    fi
+
+    for config in $CONFIGS; do
+        config_name=${config%%:*}
+        options=$(echo ${config#*:} | tr ',' ' ')
+        dir=$OUT_DIR/$config_name
+        mkdir -p $dir
+
+        bcc_cmd="$BCC -mtriple=$TRIPLE -bclib $BCLIB $options \
+                 -output_path $dir -o $name $input"
+
+        rm -f $dir/$name.times
+        for run in $(seq $RUNS); do
+            $bcc_cmd -time-phases >> $dir/$name.times
+        done
+        $bcc_cmd -instrument-passes > $dir/$name.passes
+
+        ir_ms=$(phase_ms ir_passes < $dir/$name.times | median)
+        codegen_ms=$(phase_ms codegen < $dir/$name.times | median)
+        total_ms=$(phase_ms total < $dir/$name.times | median)
+        size=$(wc -c < $dir/$name.o)
+
+        printf "%-24s %-20s %12s %12s %12s %12s\n" $name $config_name \
+            $ir_ms $codegen_ms $total_ms $size
+    done
+done
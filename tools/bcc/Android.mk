@@ -23,7 +23,9 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := bcc
 LOCAL_MODULE_CLASS := EXECUTABLES
 
-LOCAL_SRC_FILES := Main.cpp
+LOCAL_SRC_FILES := \
+  CompileServer.cpp \
+  Main.cpp
 
 LOCAL_SHARED_LIBRARIES := \
   libbcc \
@@ -47,7 +49,9 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := bcc
 LOCAL_MODULE_CLASS := EXECUTABLES
 
-LOCAL_SRC_FILES := Main.cpp
+LOCAL_SRC_FILES := \
+  CompileServer.cpp \
+  Main.cpp
 
 LOCAL_SHARED_LIBRARIES := libdl libbcinfo libbcc libLLVM libutils libcutils
 
@@ -0,0 +1,368 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CompileServer.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <bcc/Support/Log.h>
+
+#ifndef USE_MINGW
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace bcc;
+
+#ifndef USE_MINGW
+
+//===----------------------------------------------------------------------===//
+// Wire format
+//===----------------------------------------------------------------------===//
+// Client -> server:
+//   uint32_t size             (sent together with the client's stdout and
+//                              stderr as SCM_RIGHTS ancillary data)
+//   char payload[size]        (the working directory followed by every
+//                              argument, each terminated by '\0')
+// Server -> client:
+//   char accepted             (once the request is set up to run)
+//   int32_t exit_status       (missing if the compilation exits by itself,
+//                              e.g., on a command line error)
+namespace {
+
+const int kNumPassedFds = 2;
+
+bool writeAll(int pFd, const void *pBuf, size_t pCount) {
+  const char *buf = static_cast<const char *>(pBuf);
+  while (pCount > 0) {
+    ssize_t written = ::write(pFd, buf, pCount);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buf += written;
+    pCount -= written;
+  }
+  return true;
+}
+
+bool readAll(int pFd, void *pBuf, size_t pCount) {
+  char *buf = static_cast<char *>(pBuf);
+  while (pCount > 0) {
+    ssize_t bytes_read = ::read(pFd, buf, pCount);
+    if (bytes_read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    } else if (bytes_read == 0) {
+      // Peer closed the connection early.
+      return false;
+    }
+    buf += bytes_read;
+    pCount -= bytes_read;
+  }
+  return true;
+}
+
+bool fillSocketAddress(const char *pSocketPath, struct sockaddr_un &pAddr) {
+  if (::strlen(pSocketPath) >= sizeof(pAddr.sun_path)) {
+    ALOGE("Compile server socket path is too long: %s", pSocketPath);
+    return false;
+  }
+  ::memset(&pAddr, 0, sizeof(pAddr));
+  pAddr.sun_family = AF_UNIX;
+  ::strcpy(pAddr.sun_path, pSocketPath);
+  return true;
+}
+
+// Return true if the peer on pConn runs as the same user as the server. A
+// request runs with the server's credentials, so no one else may send one.
+bool isPeerTrusted(int pConn) {
+#if defined(SO_PEERCRED)
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if ((::getsockopt(pConn, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) ||
+      (len != sizeof(cred))) {
+    return false;
+  }
+  return (cred.uid == ::geteuid());
+#else
+  uid_t uid;
+  gid_t gid;
+  if (::getpeereid(pConn, &uid, &gid) != 0) {
+    return false;
+  }
+  return (uid == ::geteuid());
+#endif
+}
+
+// Receive a request on pConn, make it look like a local bcc invocation and
+// run it through pHandler. Runs in the forked child.
+int serveRequest(int pConn, CompileRequestHandler pHandler) {
+  uint32_t size;
+  int fds[kNumPassedFds];
+
+  struct iovec iov;
+  iov.iov_base = &size;
+  iov.iov_len = sizeof(size);
+
+  char control[CMSG_SPACE(sizeof(fds))];
+  struct msghdr msg;
+  ::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t received;
+  do {
+    received = ::recvmsg(pConn, &msg, 0);
+  } while ((received < 0) && (errno == EINTR));
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if ((received != sizeof(size)) || (cmsg == nullptr) ||
+      (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS) ||
+      (cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))) {
+    ALOGE("Malformed request to the compile server!");
+    return 1;
+  }
+  ::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  std::vector<char> payload(size);
+  if ((size == 0) || !readAll(pConn, payload.data(), size) ||
+      (payload.back() != '\0')) {
+    ALOGE("Malformed request to the compile server!");
+    return 1;
+  }
+
+  // The first string is the working directory, the rest are the arguments.
+  std::vector<char *> args;
+  for (size_t i = 0; i < size; i += ::strlen(&payload[i]) + 1) {
+    args.push_back(&payload[i]);
+  }
+  const char *cwd = args.front();
+  args.erase(args.begin());
+  if (args.empty()) {
+    ALOGE("Malformed request to the compile server!");
+    return 1;
+  }
+  args.push_back(nullptr);
+
+  if ((::chdir(cwd) != 0) ||
+      (::dup2(fds[0], STDOUT_FILENO) < 0) ||
+      (::dup2(fds[1], STDERR_FILENO) < 0)) {
+    ALOGE("Unable to set up compile request environment! (%s)",
+          ::strerror(errno));
+    return 1;
+  }
+  ::close(fds[0]);
+  ::close(fds[1]);
+
+  // From here on the client must not retry the request locally.
+  const char accepted = 1;
+  if (!writeAll(pConn, &accepted, sizeof(accepted))) {
+    return 1;
+  }
+
+  int32_t status = pHandler(static_cast<int>(args.size() - 1), args.data());
+
+  // Everything must reach the client before it learns we are done.
+  llvm::outs().flush();
+  llvm::errs().flush();
+  ::fflush(nullptr);
+
+  writeAll(pConn, &status, sizeof(status));
+  return 0;
+}
+
+} // end anonymous namespace
+
+int bcc::RunCompileServer(const char *pSocketPath,
+                          CompileRequestHandler pHandler) {
+  struct sockaddr_un addr;
+  if (!fillSocketAddress(pSocketPath, addr)) {
+    return 1;
+  }
+
+  int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    ALOGE("Unable to create compile server socket! (%s)", ::strerror(errno));
+    return 1;
+  }
+
+  // Replace a stale socket left behind by a previous server. Create the new
+  // one accessible to our user only.
+  ::unlink(pSocketPath);
+  mode_t old_umask = ::umask(077);
+  int bound = ::bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr),
+                     sizeof(addr));
+  ::umask(old_umask);
+  if ((bound != 0) || (::listen(listen_fd, SOMAXCONN) != 0)) {
+    ALOGE("Unable to listen on %s! (%s)", pSocketPath, ::strerror(errno));
+    ::close(listen_fd);
+    return 1;
+  }
+
+  // Children are never waited for; have the kernel reap them.
+  ::signal(SIGCHLD, SIG_IGN);
+
+  while (true) {
+    int conn = ::accept(listen_fd, nullptr, nullptr);
+    if (conn < 0) {
+      if ((errno == EINTR) || (errno == ECONNABORTED)) {
+        continue;
+      }
+      ALOGE("Compile server failed to accept a connection! (%s)",
+            ::strerror(errno));
+      break;
+    }
+
+    if (!isPeerTrusted(conn)) {
+      ALOGE("Compile server rejected a request from another user!");
+      ::close(conn);
+      continue;
+    }
+
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      ::close(listen_fd);
+      // Requests wait for children of their own (such as the optimized tier
+      // of -tiered), which an ignored SIGCHLD would reap behind their back.
+      ::signal(SIGCHLD, SIG_DFL);
+      int result = serveRequest(conn, pHandler);
+      ::close(conn);
+      // Skip the static destructors of the state shared with the server.
+      ::_exit(result);
+    } else if (pid < 0) {
+      ALOGE("Compile server failed to fork! (%s)", ::strerror(errno));
+    }
+    ::close(conn);
+  }
+
+  ::close(listen_fd);
+  return 1;
+}
+
+bool bcc::RunCompileClient(const char *pSocketPath, int pArgc, char **pArgv,
+                           int *pExitStatus) {
+  struct sockaddr_un addr;
+  if (!fillSocketAddress(pSocketPath, addr)) {
+    return false;
+  }
+
+  char cwd[PATH_MAX];
+  if (::getcwd(cwd, sizeof(cwd)) == nullptr) {
+    return false;
+  }
+
+  std::string payload(cwd);
+  payload.push_back('\0');
+  for (int i = 0; i < pArgc; i++) {
+    payload.append(pArgv[i]);
+    payload.push_back('\0');
+  }
+
+  int conn = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (conn < 0) {
+    return false;
+  }
+
+  if (::connect(conn, reinterpret_cast<struct sockaddr *>(&addr),
+                sizeof(addr)) != 0) {
+    // No server running; the caller compiles locally.
+    ::close(conn);
+    return false;
+  }
+
+  uint32_t size = payload.size();
+  int fds[kNumPassedFds] = { STDOUT_FILENO, STDERR_FILENO };
+
+  struct iovec iov;
+  iov.iov_base = &size;
+  iov.iov_len = sizeof(size);
+
+  char control[CMSG_SPACE(sizeof(fds))];
+  ::memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  ::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  ::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  ssize_t sent;
+  do {
+    sent = ::sendmsg(conn, &msg, 0);
+  } while ((sent < 0) && (errno == EINTR));
+
+  char accepted;
+  bool is_accepted = (sent == sizeof(size)) &&
+                     writeAll(conn, payload.data(), payload.size()) &&
+                     readAll(conn, &accepted, sizeof(accepted));
+  if (!is_accepted) {
+    // The request never started; the caller compiles locally instead.
+    ::close(conn);
+    return false;
+  }
+
+  // The compilation may have exited without reporting a status (e.g., after
+  // printing a command line error). Count that as a failure rather than
+  // running it again locally and repeating its output.
+  int32_t status;
+  if (!readAll(conn, &status, sizeof(status))) {
+    status = 1;
+  }
+  ::close(conn);
+
+  *pExitStatus = status;
+  return true;
+}
+
+#else  // USE_MINGW
+
+int bcc::RunCompileServer(const char *pSocketPath,
+                          CompileRequestHandler pHandler) {
+  ALOGE("The compile server is not supported on this platform!");
+  return 1;
+}
+
+bool bcc::RunCompileClient(const char *pSocketPath, int pArgc, char **pArgv,
+                           int *pExitStatus) {
+  return false;
+}
+
+#endif  // USE_MINGW
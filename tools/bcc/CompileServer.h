@@ -0,0 +1,58 @@
+/*
+ * Copyright 2015, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_TOOLS_COMPILE_SERVER_H
+#define BCC_TOOLS_COMPILE_SERVER_H
+
+//===----------------------------------------------------------------------===//
+// Compile server for the bcc tool
+//===----------------------------------------------------------------------===//
+// A compile server is a long-lived bcc process listening on a Unix domain
+// socket. It pays for the LLVM initialization and for the TargetMachine of the
+// default configuration once; every request is then served by a fork()ed
+// child that inherits that state, parses the request's command line exactly
+// like bcc would, compiles and exits.
+//
+// A client sends its working directory and command line and passes its
+// stdout and stderr along, so diagnostics appear where a local bcc would
+// print them. The server answers with the exit status of the compilation.
+//
+// Requests run with the server's credentials. The socket is only accessible
+// to the server's user, and the server also drops connections from peers
+// running as any other user.
+
+namespace bcc {
+
+// Handles one request in the server child. pArgc and pArgv are the client's
+// command line, as they would have been passed to main(). Returns the exit
+// status of the compilation.
+typedef int (*CompileRequestHandler)(int pArgc, char **pArgv);
+
+// Serve compile requests on the socket at pSocketPath until an error
+// occurs. Return the exit status for the server process.
+int RunCompileServer(const char *pSocketPath,
+                     CompileRequestHandler pHandler);
+
+// Forward the command line pArgc/pArgv to the server listening at
+// pSocketPath. Return true and set pExitStatus if the server completed the
+// request; return false if no server could be reached (or it died before
+// answering), in which case the caller should compile locally.
+bool RunCompileClient(const char *pSocketPath, int pArgc, char **pArgv,
+                      int *pExitStatus);
+
+} // end namespace bcc
+
+#endif  // BCC_TOOLS_COMPILE_SERVER_H
@@ -47,18 +47,25 @@
 #include <bcc/Support/InputFile.h>
 #include <bcc/Support/OutputFile.h>
 
+#include "CompileServer.h"
+
 using namespace bcc;
 
 #define STR2(a) #a
 #define STR(a) STR2(a)
 
+// If set to the socket of a running compile server (see -server), bcc hands
+// its command line over to that server instead of compiling by itself.
+#define BCC_SERVER_ENV "BCC_COMPILE_SERVER"
+
 //===----------------------------------------------------------------------===//
 // General Options
 //===----------------------------------------------------------------------===//
 namespace {
 
+// Not OneOrMore since a compile server (-server) takes no inputs itself.
 llvm::cl::list<std::string>
-OptInputFilenames(llvm::cl::Positional, llvm::cl::OneOrMore,
+OptInputFilenames(llvm::cl::Positional, llvm::cl::ZeroOrMore,
                   llvm::cl::desc("<input bitcode files>"));
 
 llvm::cl::list<std::string>
@@ -124,6 +131,98 @@ OptChecksum("build-checksum",
                            " cache invalidation at a later time"),
             llvm::cl::value_desc("checksum"));
 
+llvm::cl::opt<std::string>
+OptObjectCacheDir("object-cache-dir",
+                  llvm::cl::desc("Reuse objects compiled earlier from the same"
+                                 " inputs, stored in the given directory"),
+                  llvm::cl::value_desc("dir"));
+
+llvm::cl::opt<bool>
+OptSelectiveRuntimeImport("rs-selective-import",
+    llvm::cl::desc("Link only the runtime library functions the script uses"));
+
+llvm::cl::opt<bool>
+OptAtomicPublish("atomic-publish",
+    llvm::cl::desc("Write the output to a temporary file and rename it into "
+                   "place instead of locking it"));
+
+llvm::cl::opt<bool>
+OptTiered("tiered",
+          llvm::cl::desc("Write a quick -O0 object and return; a background "
+                         "process replaces it with the optimized one"));
+
+llvm::cl::opt<bool>
+OptInstrumentPasses("instrument-passes",
+                    llvm::cl::desc("Print the time and IR size change of "
+                                   "every compiler pass to stdout"));
+
+llvm::cl::opt<RSCompilerDriver::VectorizeMode>
+OptVectorize("rs-vectorize",
+             llvm::cl::desc("When to unroll and vectorize kernel loops"),
+             llvm::cl::init(RSCompilerDriver::kVectorizeRelaxed),
+             llvm::cl::values(
+                 clEnumValN(RSCompilerDriver::kVectorizeRelaxed, "relaxed",
+                            "For rs_fp_relaxed scripts (default)"),
+                 clEnumValN(RSCompilerDriver::kVectorizeAlways, "always",
+                            "For all scripts"),
+                 clEnumValN(RSCompilerDriver::kVectorizeNever, "never",
+                            "Never"),
+                 clEnumValEnd));
+
+llvm::cl::opt<bool>
+OptRSPipeline("rs-pipeline",
+              llvm::cl::desc("Optimize with the pipeline tuned for "
+                             "RenderScript instead of the generic LTO one"));
+
+llvm::cl::opt<int>
+OptInlineThreshold("rs-inline-threshold",
+                   llvm::cl::desc("Inline functions up to the given cost "
+                                  "instead of the default of the pipeline"),
+                   llvm::cl::value_desc("threshold"), llvm::cl::init(-1));
+
+llvm::cl::opt<bool>
+OptMultiVersion("rs-multiversion",
+                llvm::cl::desc("Also compile the expanded kernels for newer "
+                               "CPUs and emit a resolver to select them"));
+
+llvm::cl::opt<bool>
+OptExpandTiles("rs-expand-tiles",
+               llvm::cl::desc("Also expand kernels into functions over tiles "
+                              "of several rows"));
+
+llvm::cl::opt<bool>
+OptProfileInstrument("rs-profile-instrument",
+                     llvm::cl::desc("Add profile counters to the kernels, "
+                                    "invokable functions and the script "
+                                    "functions they call"));
+
+llvm::cl::opt<std::string>
+OptProfileUse("rs-profile-use",
+              llvm::cl::desc("Optimize with the given profile of an "
+                             "instrumented build"),
+              llvm::cl::value_desc("file"));
+
+llvm::cl::opt<unsigned>
+OptCompileBudget("compile-budget",
+                 llvm::cl::desc("Lower the optimization of the script until "
+                                "its estimated compile cost, a relative "
+                                "measure rather than a time, fits the given "
+                                "budget (0: off)"),
+                 llvm::cl::init(0));
+
+llvm::cl::opt<bool>
+OptTimePhases("time-phases",
+              llvm::cl::desc("Print the time spent in each compilation phase "
+                             "as JSON to stdout"));
+
+llvm::cl::opt<std::string>
+OptServerSocket("server",
+                llvm::cl::desc("Run as a compile server listening on the "
+                               "given Unix domain socket. Clients are bcc "
+                               "invocations with " BCC_SERVER_ENV " set to "
+                               "the same socket"),
+                llvm::cl::value_desc("socket"));
+
 //===----------------------------------------------------------------------===//
 // Compiler Options
 //===----------------------------------------------------------------------===//
@@ -291,6 +390,48 @@ bool ConfigCompiler(RSCompilerDriver &pRSCD) {
     pRSCD.setEmbedGlobalInfoSkipConstant(true);
   }
 
+  if (OptSelectiveRuntimeImport) {
+    pRSCD.setSelectiveRuntimeImport(true);
+  }
+
+  if (OptAtomicPublish) {
+    pRSCD.setAtomicPublish(true);
+  }
+
+  if (OptInstrumentPasses) {
+    pRSCD.setInstrumentPasses(true);
+  }
+
+  pRSCD.setVectorizeMode(OptVectorize);
+
+  if (OptRSPipeline) {
+    pRSCD.setUseRSPipeline(true);
+  }
+
+  pRSCD.setInlineThreshold(OptInlineThreshold);
+
+  if (OptMultiVersion) {
+    pRSCD.setMultiVersionKernels(true);
+  }
+
+  if (OptExpandTiles) {
+    pRSCD.setExpandTiles(true);
+  }
+
+  if (OptProfileInstrument) {
+    pRSCD.setProfileInstrument(true);
+  } else if (!OptProfileUse.empty()) {
+    pRSCD.setProfilePath(OptProfileUse.c_str());
+  }
+
+  if (OptCompileBudget != 0) {
+    pRSCD.setCompileBudget(OptCompileBudget);
+  }
+
+  if (!OptObjectCacheDir.empty()) {
+    pRSCD.setObjectCacheDir(OptObjectCacheDir.c_str());
+  }
+
   if (result != Compiler::kSuccess) {
     llvm::errs() << "Failed to configure the compiler! (detail: "
                  << Compiler::GetErrorString(result) << ")\n";
@@ -300,15 +441,12 @@ bool ConfigCompiler(RSCompilerDriver &pRSCD) {
   return true;
 }
 
-int main(int argc, char **argv) {
-
-  llvm::llvm_shutdown_obj Y;
-  init::Initialize();
-  llvm::cl::SetVersionPrinter(BCCVersionPrinter);
-  llvm::cl::ParseCommandLineOptions(argc, argv);
-
-  BCCContext context;
-  RSCompilerDriver RSCD;
+// Compile with RSCD according to the (already parsed) command line options.
+static int compile(BCCContext &context, RSCompilerDriver &RSCD) {
+  if (OptInputFilenames.empty()) {
+    ALOGE("Failed to compile bitcode, no input file was specified");
+    return EXIT_FAILURE;
+  }
 
   if (OptBCLibFilename.empty()) {
     ALOGE("Failed to compile bitcode, -bclib was not specified");
@@ -350,7 +488,20 @@ int main(int argc, char **argv) {
   const char *bitcode = input_data->getBufferStart();
   size_t bitcodeSize = input_data->getBufferSize();
 
-  if (!OptEmbedRSInfo) {
+  if (OptTiered && !OptEmitLLVM) {
+    // Return once the quick object is in place; a child process publishes
+    // the optimized one after bcc has exited.
+    RSCD.setOptimizedTierProcess(true);
+    bool built = RSCD.buildTiered(context, OptOutputPath.c_str(),
+                                  OptOutputFilename.c_str(),
+                                  bitcode, bitcodeSize,
+                                  OptChecksum.c_str(),
+                                  OptBCLibFilename.c_str(),
+                                  OptEmbedRSInfo);
+    if (!built) {
+      return EXIT_FAILURE;
+    }
+  } else if (!OptEmbedRSInfo) {
     bool built = RSCD.build(context, OptOutputPath.c_str(),
                             OptOutputFilename.c_str(),
                             bitcode, bitcodeSize,
@@ -386,3 +537,93 @@ int main(int argc, char **argv) {
 
   return EXIT_SUCCESS;
 }
+
+static int compileAndReport(BCCContext &context, RSCompilerDriver &RSCD) {
+  int status = compile(context, RSCD);
+
+  if (OptTimePhases) {
+    RSCD.getPhaseTimes().printJSON(llvm::outs());
+  }
+
+  if (OptInstrumentPasses) {
+    RSCD.getPassReport().print(llvm::outs());
+  }
+
+  return status;
+}
+
+static int compile() {
+  BCCContext context;
+  RSCompilerDriver RSCD;
+
+  return compileAndReport(context, RSCD);
+}
+
+// The context and driver of a compile server. They are set up before the
+// server starts serving, so every request child inherits them, including the
+// TargetMachine of the default configuration (see Compiler::config()).
+static BCCContext *gServerContext = nullptr;
+static RSCompilerDriver *gServerDriver = nullptr;
+
+// Serve one request forwarded to a compile server. This runs in a child forked
+// from the server, so the options parsed here do not leak into other requests.
+static int compileRequest(int argc, char **argv) {
+  llvm::cl::ParseCommandLineOptions(argc, argv);
+  return compileAndReport(*gServerContext, *gServerDriver);
+}
+
+// Return true if the command line sets nothing but -server. Every other option
+// belongs to the requests: a request child parses its own command line on top
+// of the options of the server, so these must all still be at their defaults.
+static bool isServerOnlyCommandLine(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    llvm::StringRef arg(argv[i]);
+    if ((arg == "-server") || (arg == "--server")) {
+      i++;  // Skip the socket.
+    } else if (!arg.startswith("-server=") && !arg.startswith("--server=")) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  // Hand the whole command line to a compile server if there is one. This is
+  // done before any initialization since saving that is the whole point.
+  const char *server_socket = ::getenv(BCC_SERVER_ENV);
+  if ((server_socket != nullptr) && (server_socket[0] != '\0')) {
+    int status;
+    if (RunCompileClient(server_socket, argc, argv, &status)) {
+      return status;
+    }
+    // Otherwise fall back to compiling locally.
+  }
+
+  llvm::llvm_shutdown_obj Y;
+  init::Initialize();
+  llvm::cl::SetVersionPrinter(BCCVersionPrinter);
+  llvm::cl::ParseCommandLineOptions(argc, argv);
+
+  if (!OptServerSocket.empty()) {
+    if (!isServerOnlyCommandLine(argc, argv)) {
+      llvm::errs() << "-server takes no other options; pass them with each "
+                      "request instead\n";
+      return EXIT_FAILURE;
+    }
+
+    // The server itself must not try to forward requests to itself.
+    ::unsetenv(BCC_SERVER_ENV);
+
+    gServerContext = new (std::nothrow) BCCContext();
+    gServerDriver = new (std::nothrow) RSCompilerDriver();
+    if ((gServerContext == nullptr) || (gServerDriver == nullptr) ||
+        !ConfigCompiler(*gServerDriver)) {
+      llvm::errs() << "Failed to set up the compile server!\n";
+      return EXIT_FAILURE;
+    }
+
+    return RunCompileServer(OptServerSocket.c_str(), compileRequest);
+  }
+
+  return compile();
+}